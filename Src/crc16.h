@@ -0,0 +1,18 @@
+#ifndef CRC16_H_
+#define CRC16_H_
+
+#include "stdint.h"
+#include "stddef.h"
+
+// CRC-16/X.25 (HDLC FCS), as used by the Tonex One framing.
+// The final value is inverted and sent LSB first after the payload
+#define CRC16_INIT				0xFFFF
+
+// Register value after a payload and its (inverted) CRC have both been passed through crc16_Update
+#define CRC16_GOOD_RESIDUAL	0xF0B8
+
+uint16_t crc16_Calculate(const uint8_t* data, size_t length);
+uint16_t crc16_Update(uint16_t crc, uint8_t byte);
+uint16_t crc16_UpdateBlock(uint16_t crc, const uint8_t* data, size_t length);
+
+#endif // CRC16_H_
@@ -4,6 +4,7 @@
 #include "wifi_management.h"
 #include "WiFi.h"
 #include "soc/rtc_cntl_reg.h"
+#include "esp_timer.h"
 
 #ifdef USE_EXTERNAL_USB_HOST
 #include "usb_host.h"
@@ -23,8 +24,48 @@ uint8_t blockWirelessMidi = 0;
 
 const char* ESP32_TAG = "ESP32_MANAGER";
 
+#define ESP32_BOOT_PHASES_MAX		16
+
+typedef struct
+{
+	const char* name;
+	int64_t time;		// us since boot
+} Esp32BootPhase;
+
+static Esp32BootPhase bootPhases[ESP32_BOOT_PHASES_MAX];
+static uint8_t bootPhaseCount = 0;
+static portMUX_TYPE bootPhaseMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Two snapshots, the published one and a spare that is written once no task is still using it
+static Esp32ManagerSnapshot snapshots[2];
+static Esp32ManagerSnapshot* currentSnapshot = NULL;
+static Esp32ManagerSnapshot* pendingSnapshot = NULL;
+static volatile uint8_t readerActive[Esp32ReaderCount];
+static volatile uint32_t readerVersions[Esp32ReaderCount];
+
+uint8_t esp32Manager_WaitForReaders(uint32_t version);
+
 // Initialise all included components
+// With USE_LAZY_INIT only wired MIDI is started here. WiFi, USB host and BLE start from their own
+// tasks once esp32Manager_CreateTasks has run, each becoming routable as soon as it is up
 void esp32Manager_Init()
+{
+	esp32Manager_BootPhase("Init");
+#ifdef USE_LAZY_INIT
+	midi_Init();
+	esp32Manager_BootPhase("Wired MIDI started");
+#else
+	esp32Manager_InitWiFi();
+	esp32Manager_InitUsbHost();
+	midi_Init();
+#ifdef USE_BLE_MIDI
+	midi_InitBLE();
+#endif
+	esp32Manager_BootPhase("MIDI started");
+#endif
+}
+
+void esp32Manager_InitWiFi()
 {
 #ifdef USE_WIFI_RTP_MIDI
 	if(esp32ConfigPtr->wirelessType == Esp32WiFi)
@@ -38,15 +79,132 @@ void esp32Manager_Init()
 		if(esp32Info.wifiConnected != 0)
 			wifi_CheckConnectionPing();
 		midi_InitWiFiRTP();
+		esp32Manager_BootPhase("WiFi started");
 	}
 #endif
-	// Initialise USB host components
+}
+
+void esp32Manager_InitUsbHost()
+{
 #ifdef USE_EXTERNAL_USB_HOST
 	usbh_Init();
 	cdc_Init();
+	esp32Manager_BootPhase("USB host started");
 #endif
-	midi_Init();
-	
+}
+
+// Returns a writable copy of the current config and thru handles. Change it, then publish it with
+// esp32Manager_PublishConfig. Only one task should change the config
+Esp32ManagerSnapshot* esp32Manager_BeginConfig()
+{
+	Esp32ManagerSnapshot* current = __atomic_load_n(&currentSnapshot, __ATOMIC_ACQUIRE);
+	Esp32ManagerSnapshot* spare = (current == &snapshots[0]) ? &snapshots[1] : &snapshots[0];
+
+	if(current == NULL)
+	{
+		spare->config = *esp32ConfigPtr;
+		midi_GetThruHandles(spare);
+		spare->version = 1;
+	}
+	else
+	{
+		// The spare holds the version before the current one, wait for every task to move off it
+		if(!esp32Manager_WaitForReaders(current->version))
+		{
+			ESP_LOGW(ESP32_TAG, "Config version %lu still in use, change not started", current->version - 1);
+			return NULL;
+		}
+		memcpy(spare, current, sizeof(Esp32ManagerSnapshot));
+		spare->version = current->version + 1;
+	}
+	pendingSnapshot = spare;
+	return spare;
+}
+
+// Makes the snapshot from esp32Manager_BeginConfig the current one. The tasks pick it up at their
+// next safe point, only restarting what changed
+uint32_t esp32Manager_PublishConfig()
+{
+	Esp32ManagerSnapshot* snapshot = pendingSnapshot;
+
+	if(snapshot == NULL)
+	{
+		return 0;
+	}
+	pendingSnapshot = NULL;
+	__atomic_store_n(&currentSnapshot, snapshot, __ATOMIC_RELEASE);
+	esp32ConfigPtr = &snapshot->config;
+	ESP_LOGI(ESP32_TAG, "Config version %lu published", snapshot->version);
+	return snapshot->version;
+}
+
+// Called by a task where it is safe to change config. Returns the newest snapshot if it has not
+// been seen by this task yet, otherwise NULL. The previous snapshot is no longer used by the task
+const Esp32ManagerSnapshot* esp32Manager_ConfigSafePoint(Esp32ConfigReader reader)
+{
+	__atomic_store_n(&readerActive[reader], 1, __ATOMIC_SEQ_CST);
+	const Esp32ManagerSnapshot* snapshot = __atomic_load_n(&currentSnapshot, __ATOMIC_ACQUIRE);
+
+	if(snapshot == NULL || snapshot->version == readerVersions[reader])
+	{
+		return NULL;
+	}
+	__atomic_store_n(&readerVersions[reader], snapshot->version, __ATOMIC_SEQ_CST);
+	return snapshot;
+}
+
+uint32_t esp32Manager_ConfigVersion()
+{
+	const Esp32ManagerSnapshot* snapshot = __atomic_load_n(&currentSnapshot, __ATOMIC_ACQUIRE);
+	return snapshot == NULL ? 0 : snapshot->version;
+}
+
+// Waits until every running reader task has passed a safe point since version was published
+uint8_t esp32Manager_WaitForReaders(uint32_t version)
+{
+	for(uint16_t waited = 0; waited < ESP32_CONFIG_GRACE_TIMEOUT; waited++)
+	{
+		uint8_t released = 1;
+		for(uint8_t reader = 0; reader < Esp32ReaderCount; reader++)
+		{
+			if(readerActive[reader] && readerVersions[reader] != version)
+			{
+				released = 0;
+			}
+		}
+		if(released)
+		{
+			return 1;
+		}
+		vTaskDelay(1 / portTICK_PERIOD_MS);
+	}
+	return 0;
+}
+
+// Records the time a startup phase completed
+void esp32Manager_BootPhase(const char* name)
+{
+	int64_t time = esp_timer_get_time();
+
+	portENTER_CRITICAL(&bootPhaseMux);
+	if(bootPhaseCount < ESP32_BOOT_PHASES_MAX)
+	{
+		bootPhases[bootPhaseCount].name = name;
+		bootPhases[bootPhaseCount].time = time;
+		bootPhaseCount++;
+	}
+	portEXIT_CRITICAL(&bootPhaseMux);
+	ESP_LOGI(ESP32_TAG, "Boot phase \"%s\" at %lld us", name, time);
+}
+
+void esp32Manager_PrintBootReport()
+{
+	Serial.print("{\"bootPhases\":[");
+	for(uint8_t i = 0; i < bootPhaseCount; i++)
+	{
+		Serial.printf("%s{\"name\":\"%s\",\"us\":%lld}", i == 0 ? "" : ",", bootPhases[i].name, bootPhases[i].time);
+	}
+	Serial.print("]}~\n");
 }
 
 void esp32Manager_CreateTasks()
@@ -63,6 +63,28 @@ typedef struct
 	uint8_t bleConnected;	// 0 = not connected, 1 = connected (server)
 } Esp32ManagerInfo;
 
+// Config changes made while running are published as a versioned snapshot. The MIDI, WiFi and BLE
+// tasks each switch to a new snapshot at a safe point in their loop, so a snapshot is only reused
+// once every task has moved off it
+#define ESP32_THRU_INTERFACES_MAX		16			// at least MidiNone
+#define ESP32_CONFIG_GRACE_TIMEOUT		2000		// ms to wait for the tasks to release the spare snapshot
+
+typedef enum
+{
+	Esp32ReaderMidi,
+	Esp32ReaderWiFi,
+	Esp32ReaderBLE,
+	Esp32ReaderCount
+} Esp32ConfigReader;
+
+typedef struct
+{
+	uint32_t version;
+	Esp32ManagerConfig config;
+	uint16_t thruSources;		// bit per source interface that has a thru row
+	uint8_t thru[ESP32_THRU_INTERFACES_MAX][ESP32_THRU_INTERFACES_MAX];
+} Esp32ManagerSnapshot;
+
 extern Esp32ManagerConfig* esp32ConfigPtr;	// Pointer to the config structure of the application
 extern Esp32ManagerInfo esp32Info;				// Defined by the ESP32 manager
 
@@ -71,8 +93,18 @@ extern uint8_t blockWirelessMidi;
 
 
 void esp32Manager_Init();
+void esp32Manager_InitWiFi();
+void esp32Manager_InitUsbHost();
 void esp32Manager_CreateTasks();
 void esp32Manager_Process();
 void esp32Manager_EnterBootloader();
 
+Esp32ManagerSnapshot* esp32Manager_BeginConfig();
+uint32_t esp32Manager_PublishConfig();
+const Esp32ManagerSnapshot* esp32Manager_ConfigSafePoint(Esp32ConfigReader reader);
+uint32_t esp32Manager_ConfigVersion();
+
+void esp32Manager_BootPhase(const char* name);
+void esp32Manager_PrintBootReport();
+
 #endif // ESP32_HANDLER_H_
\ No newline at end of file
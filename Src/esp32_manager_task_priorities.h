@@ -11,4 +11,7 @@
 
 #define ESP_LINK_TASK_PRIORITY (tskIDLE_PRIORITY  + 3)
 
+#define OTA_PULL_TASK_PRIORITY (tskIDLE_PRIORITY  + 1)
+#define OTA_WRITE_TASK_PRIORITY (tskIDLE_PRIORITY  + 1)
+
 #endif // TASK_PRIORITIES_H_
\ No newline at end of file
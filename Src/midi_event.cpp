@@ -0,0 +1,265 @@
+#include "midi_event.h"
+#include "string.h"
+
+//---------------------- Private Function Prototypes ----------------------//
+uint8_t midiEvent_MessageLength(uint8_t status);
+
+//---------------------- Public Functions ----------------------//
+// Decodes a MIDI 1.0 message. Returns 0 for SysEx and anything that is not a complete message
+uint8_t midiEvent_FromMessage(MidiEvent* event, uint8_t status, uint8_t data1, uint8_t data2)
+{
+	uint32_t ump[2];
+	uint32_t messageType = status < 0xF0 ? MIDI_EVENT_UMP_CHANNEL : MIDI_EVENT_UMP_SYSTEM;
+
+	ump[0] = (messageType << 28) | ((uint32_t)status << 16) | ((uint32_t)(data1 & 0x7F) << 8) | (data2 & 0x7F);
+	ump[1] = 0;
+	return midiEvent_FromUmp(event, ump);
+}
+
+// Builds one SysEx7 packet from up to 6 data bytes, without the F0 and F7
+uint8_t midiEvent_FromSysEx7(MidiEvent* event, uint8_t form, const uint8_t* data, uint8_t count)
+{
+	uint8_t packed[MIDI_EVENT_SYSEX_MAX_BYTES] = {0};
+	uint32_t ump[2];
+
+	if(count > MIDI_EVENT_SYSEX_MAX_BYTES || form > MIDI_EVENT_SYSEX_END)
+	{
+		return 0;
+	}
+	for(uint8_t i = 0; i < count; i++)
+	{
+		packed[i] = data[i] & 0x7F;
+	}
+	ump[0] = ((uint32_t)MIDI_EVENT_UMP_SYSEX7 << 28) | ((uint32_t)form << 20) | ((uint32_t)count << 16) | ((uint32_t)packed[0] << 8) | packed[1];
+	ump[1] = ((uint32_t)packed[2] << 24) | ((uint32_t)packed[3] << 16) | ((uint32_t)packed[4] << 8) | packed[5];
+	return midiEvent_FromUmp(event, ump);
+}
+
+// Loads a packet, checking it is one the MIDI 1.0 edges can translate
+uint8_t midiEvent_FromUmp(MidiEvent* event, const uint32_t* ump)
+{
+	uint8_t length;
+
+	event->ump[0] = ump[0];
+	event->ump[1] = ump[1];
+	switch(midiEvent_Type(event))
+	{
+		case MIDI_EVENT_UMP_SYSTEM:
+		case MIDI_EVENT_UMP_CHANNEL:
+			length = midiEvent_MessageLength(midiEvent_Status(event));
+			if(length == 0)
+			{
+				return 0;
+			}
+			// unused data bytes are kept zero so the encodings can copy all three
+			if(length < 3)
+				event->ump[0] &= 0xFFFFFF00;
+			if(length < 2)
+				event->ump[0] &= 0xFFFF00FF;
+			break;
+
+		case MIDI_EVENT_UMP_SYSEX7:
+		{
+			uint8_t form = midiEvent_SysExForm(event);
+			length = (ump[0] >> 16) & 0x0F;
+			if(length > MIDI_EVENT_SYSEX_MAX_BYTES || form > MIDI_EVENT_SYSEX_END)
+			{
+				return 0;
+			}
+			if(form == MIDI_EVENT_SYSEX_COMPLETE || form == MIDI_EVENT_SYSEX_START)
+				length++;
+			if(form == MIDI_EVENT_SYSEX_COMPLETE || form == MIDI_EVENT_SYSEX_END)
+				length++;
+			break;
+		}
+
+		default:
+			return 0;
+	}
+	event->length = length;
+	event->encoded = 0;
+	return 1;
+}
+
+uint8_t midiEvent_Type(const MidiEvent* event)
+{
+	return event->ump[0] >> 28;
+}
+
+uint8_t midiEvent_Status(const MidiEvent* event)
+{
+	if(midiEvent_Type(event) == MIDI_EVENT_UMP_SYSEX7)
+	{
+		return 0xF0;
+	}
+	return (event->ump[0] >> 16) & 0xFF;
+}
+
+// Real time messages may be sent anywhere in a MIDI 1.0 stream, including inside SysEx
+uint8_t midiEvent_IsRealTime(const MidiEvent* event)
+{
+	return midiEvent_Type(event) == MIDI_EVENT_UMP_SYSTEM && midiEvent_Status(event) >= 0xF8;
+}
+
+uint8_t midiEvent_SysExForm(const MidiEvent* event)
+{
+	return (event->ump[0] >> 20) & 0x0F;
+}
+
+uint8_t midiEvent_Length(const MidiEvent* event)
+{
+	return event->length;
+}
+
+const uint8_t* midiEvent_Bytes(MidiEvent* event)
+{
+	if(!(event->encoded & MIDI_EVENT_HAS_BYTES))
+	{
+		if(midiEvent_Type(event) == MIDI_EVENT_UMP_SYSEX7)
+		{
+			uint8_t form = midiEvent_SysExForm(event);
+			uint8_t count = (event->ump[0] >> 16) & 0x0F;
+			uint8_t index = 0;
+
+			if(form == MIDI_EVENT_SYSEX_COMPLETE || form == MIDI_EVENT_SYSEX_START)
+				event->bytes[index++] = 0xF0;
+			for(uint8_t i = 0; i < count; i++)
+			{
+				// data bytes 0 and 1 are in the first word, 2 to 5 in the second
+				event->bytes[index++] = i < 2 ? (event->ump[0] >> (8 - i * 8)) & 0xFF : (event->ump[1] >> (24 - (i - 2) * 8)) & 0xFF;
+			}
+			if(form == MIDI_EVENT_SYSEX_COMPLETE || form == MIDI_EVENT_SYSEX_END)
+				event->bytes[index++] = 0xF7;
+		}
+		else
+		{
+			event->bytes[0] = (event->ump[0] >> 16) & 0xFF;
+			event->bytes[1] = (event->ump[0] >> 8) & 0xFF;
+			event->bytes[2] = event->ump[0] & 0xFF;
+		}
+		event->encoded |= MIDI_EVENT_HAS_BYTES;
+	}
+	return event->bytes;
+}
+
+// The code index number follows the message size, real time messages use the single byte code.
+// SysEx is split into 3 byte packets, so every packet but the last of a message must be full.
+// Packets made by midi_PostSysEx keep to this, start packets carry 5 bytes after the F0
+const uint8_t* midiEvent_UsbPackets(MidiEvent* event, uint8_t* count)
+{
+	if(!(event->encoded & MIDI_EVENT_HAS_USB))
+	{
+		const uint8_t* bytes = midiEvent_Bytes(event);
+		uint8_t status = midiEvent_Status(event);
+
+		memset(event->usbPackets, 0, sizeof(event->usbPackets));
+		if(midiEvent_Type(event) == MIDI_EVENT_UMP_SYSEX7)
+		{
+			uint8_t form = midiEvent_SysExForm(event);
+			uint8_t ends = form == MIDI_EVENT_SYSEX_COMPLETE || form == MIDI_EVENT_SYSEX_END;
+
+			event->usbPacketCount = 0;
+			for(uint8_t index = 0; index < event->length; index += 3)
+			{
+				uint8_t* packet = &event->usbPackets[event->usbPacketCount * 4];
+				uint8_t size = event->length - index < 3 ? event->length - index : 3;
+
+				packet[0] = (ends && index + size == event->length) ? 0x4 + size : 0x4;
+				memcpy(&packet[1], &bytes[index], size);
+				event->usbPacketCount++;
+			}
+		}
+		else
+		{
+			uint8_t cin;
+			if(status < 0xF0)
+				cin = status >> 4;
+			else if(status >= 0xF8)
+				cin = 0xF;
+			else
+				cin = event->length == 1 ? 0x5 : event->length;
+
+			event->usbPackets[0] = cin;
+			memcpy(&event->usbPackets[1], bytes, 3);
+			event->usbPacketCount = 1;
+		}
+		event->encoded |= MIDI_EVENT_HAS_USB;
+	}
+	*count = event->usbPacketCount;
+	return event->usbPackets;
+}
+
+uint8_t midiEventRing_Push(MidiEventRing* ring, const MidiEvent* event)
+{
+	if(midiEventRing_Count(ring) >= MIDI_EVENT_RING_SIZE)
+	{
+		return 0;
+	}
+	uint32_t* slot = ring->slots[ring->head & (MIDI_EVENT_RING_SIZE - 1)];
+	slot[0] = event->ump[0];
+	slot[1] = event->ump[1];
+	ring->head++;
+	return 1;
+}
+
+// Loads the oldest packet without removing it. Packets that cannot be loaded are discarded
+uint8_t midiEventRing_Peek(MidiEventRing* ring, MidiEvent* event)
+{
+	while(midiEventRing_Count(ring) > 0)
+	{
+		if(midiEvent_FromUmp(event, ring->slots[ring->tail & (MIDI_EVENT_RING_SIZE - 1)]))
+		{
+			return 1;
+		}
+		ring->tail++;
+	}
+	return 0;
+}
+
+uint8_t midiEventRing_Pop(MidiEventRing* ring, MidiEvent* event)
+{
+	if(!midiEventRing_Peek(ring, event))
+	{
+		return 0;
+	}
+	ring->tail++;
+	return 1;
+}
+
+uint16_t midiEventRing_Count(const MidiEventRing* ring)
+{
+	return (uint16_t)(ring->head - ring->tail);
+}
+
+//---------------------- Private Functions ----------------------//
+uint8_t midiEvent_MessageLength(uint8_t status)
+{
+	if(status < 0x80)
+	{
+		return 0;
+	}
+	if(status < 0xF0)
+	{
+		uint8_t type = status & 0xF0;
+		return (type == 0xC0 || type == 0xD0) ? 2 : 3;
+	}
+	switch(status)
+	{
+		case 0xF1:
+		case 0xF3:
+			return 2;
+		case 0xF2:
+			return 3;
+		case 0xF6:
+		case 0xF8:
+		case 0xFA:
+		case 0xFB:
+		case 0xFC:
+		case 0xFE:
+		case 0xFF:
+			return 1;
+		// SysEx, its end marker and the undefined statuses
+		default:
+			return 0;
+	}
+}
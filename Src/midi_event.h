@@ -0,0 +1,65 @@
+#ifndef MIDI_EVENT_H_
+#define MIDI_EVENT_H_
+
+#include "stdint.h"
+
+// Routed messages are held as Universal MIDI Packets. The first word is laid out as
+//   message type (4) | group (4) | status (8) | data1 (8) | data2 (8)
+// for system (0x1) and MIDI 1.0 channel voice (0x2) messages. SysEx travels as 64 bit SysEx7
+// packets (0x3) of up to 6 bytes each:
+//   0x3 (4) | group (4) | form (4) | byte count (4) | 6 data bytes
+// Each MIDI 1.0 wire encoding is built the first time a destination asks for it and reused after that
+#define MIDI_EVENT_UMP_SYSTEM			0x1
+#define MIDI_EVENT_UMP_CHANNEL		0x2
+#define MIDI_EVENT_UMP_SYSEX7			0x3
+
+#define MIDI_EVENT_SYSEX_COMPLETE	0x0
+#define MIDI_EVENT_SYSEX_START		0x1
+#define MIDI_EVENT_SYSEX_CONTINUE	0x2
+#define MIDI_EVENT_SYSEX_END			0x3
+#define MIDI_EVENT_SYSEX_MAX_BYTES	6
+
+#define MIDI_EVENT_HAS_BYTES			0x01
+#define MIDI_EVENT_HAS_USB				0x02
+
+// Slots per ring, must be a power of 2
+#ifndef MIDI_EVENT_RING_SIZE
+#define MIDI_EVENT_RING_SIZE			32
+#endif
+
+typedef struct
+{
+	uint32_t ump[2];				// the second word is only used by SysEx7
+	uint8_t encoded;				// MIDI_EVENT_HAS_* encodings already built
+	uint8_t length;				// serial byte count
+	uint8_t bytes[8];				// MIDI 1.0 serial bytes, SysEx7 adds F0 and F7 at its ends
+	uint8_t usbPacketCount;
+	uint8_t usbPackets[12];		// USB MIDI event packets on cable 0
+} MidiEvent;
+
+// Fixed size FIFO of packets. Pushed and popped from the same task, so it has no locking
+typedef struct
+{
+	uint32_t slots[MIDI_EVENT_RING_SIZE][2];
+	uint16_t head;
+	uint16_t tail;
+} MidiEventRing;
+
+uint8_t midiEvent_FromMessage(MidiEvent* event, uint8_t status, uint8_t data1, uint8_t data2);
+uint8_t midiEvent_FromSysEx7(MidiEvent* event, uint8_t form, const uint8_t* data, uint8_t count);
+uint8_t midiEvent_FromUmp(MidiEvent* event, const uint32_t* ump);
+
+uint8_t midiEvent_Type(const MidiEvent* event);
+uint8_t midiEvent_Status(const MidiEvent* event);
+uint8_t midiEvent_IsRealTime(const MidiEvent* event);
+uint8_t midiEvent_SysExForm(const MidiEvent* event);
+uint8_t midiEvent_Length(const MidiEvent* event);
+const uint8_t* midiEvent_Bytes(MidiEvent* event);
+const uint8_t* midiEvent_UsbPackets(MidiEvent* event, uint8_t* count);
+
+uint8_t midiEventRing_Push(MidiEventRing* ring, const MidiEvent* event);
+uint8_t midiEventRing_Peek(MidiEventRing* ring, MidiEvent* event);
+uint8_t midiEventRing_Pop(MidiEventRing* ring, MidiEvent* event);
+uint16_t midiEventRing_Count(const MidiEventRing* ring);
+
+#endif // MIDI_EVENT_H_
@@ -3,6 +3,7 @@
 #include "MIDI.h"
 #include "midi_Defs.h"
 #include "midi_handling.h"
+#include "midi_event.h"
 
 #ifdef USE_BLE_MIDI
 #include <BLEMIDI_Transport.h>
@@ -20,10 +21,6 @@
 #endif
 
 #include "SPI.h"
-#ifdef USE_USBH_MIDI
-
-#include "usbhost.h"
-#endif
 #include "Adafruit_TinyUSB.h"
 #include <device_api.h>
 
@@ -37,6 +34,9 @@
 #ifdef USE_ESP_LINK
 #include "esp_link.h"
 #endif
+#ifdef USE_TONEX_ONE
+#include "tonexOne_MidiMap.h"
+#endif
 
 const char* TAG = "MIDI";
 
@@ -80,13 +80,55 @@ void (*mPetalProgramChangeCallback)(MidiInterfaceType interface, uint8_t channel
 // MIDI thru array pointers
 uint8_t numMidiHandles = 0;
 uint8_t* usbdMidiThruHandlesPtr = NULL;
-uint8_t* usbhMidiThruHandlesPtr = NULL;
+#ifdef USE_USBH_MIDI
+uint8_t* usbhMidiThruHandlesPtr[USBH_MIDI_MAX_PORTS] = {NULL};
+#endif
 uint8_t* bleMidiThruHandlesPtr = NULL;
 uint8_t* wifiMidiThruHandlesPtr = NULL;
 uint8_t* serial0MidiThruHandlesPtr = NULL;
 uint8_t* serial1MidiThruHandlesPtr = NULL;
 uint8_t* serial2MidiThruHandlesPtr = NULL;
 
+// Wireless transports can start after the MIDI task is running, they are not routed until then
+#ifdef USE_BLE_MIDI
+static volatile uint8_t bleMidiStarted = 0;
+static Esp32BLEMode bleMidiMode = Esp32BLEServer;		// mode BLE MIDI was started in
+#endif
+#ifdef USE_WIFI_RTP_MIDI
+static volatile uint8_t rtpMidiStarted = 0;
+#endif
+
+// Counts MIDI task passes so a transport can be stopped once nothing is reading it
+static volatile uint32_t midiPassCount = 0;
+
+// Routed messages wait as packets in a queue per source. SysEx is split into SysEx7 packets on the
+// way in. The carry holds bytes until a packet is full, so no USB packet but the last is short
+#define MIDI_ROUTE_BUDGET					64			// packets routed per MIDI task pass
+#define MIDI_SYSEX_ROUTE_TIMEOUT			500		// ms without the rest of a SysEx before it is ended
+
+typedef struct
+{
+	MidiEventRing ring;
+	uint8_t sysExOpen;			// F0 received and F7 not yet
+	uint8_t sysExStarted;		// start packet queued
+	uint8_t carry[MIDI_EVENT_SYSEX_MAX_BYTES];
+	uint8_t carryLength;
+} MidiSource;
+
+static MidiSource midiSources[MidiNone];
+static uint8_t routeOwner = MidiNone;		// source whose SysEx is part way through being routed
+static uint32_t routeOwnerTime = 0;
+static uint8_t routeNextSource = 0;
+static uint32_t routeDropped = 0;
+#ifdef USE_BLE_MIDI
+static uint8_t bleSysExOpen = 0;
+#endif
+#ifdef USE_WIFI_RTP_MIDI
+static uint8_t rtpSysExOpen = 0;
+#endif
+
+static_assert(MidiNone <= ESP32_THRU_INTERFACES_MAX, "ESP32_THRU_INTERFACES_MAX is smaller than the number of MIDI interfaces");
+
 #ifdef USE_BLE_MIDI
 void midi_LinkCreateDataPacket(MidiInterfaceType interface, midi::MidiType type, uint8_t channel, uint8_t data1, uint8_t data2);
 void midi_LinkProcessReceivedData(uint8_t* data, uint16_t size);
@@ -127,9 +169,9 @@ MIDI_CREATE_INSTANCE(Adafruit_USBD_MIDI, usbd_midi, usbdMidi);
 #endif
 
 // USBH
+// Each USB host MIDI port is MidiUSBH plus its port number
 #ifdef USE_USBH_MIDI
-extern Adafruit_USBH_Host usbh_midi;
-
+#define MIDI_IS_USBH(interface)	((interface) >= MidiUSBH && (interface) <= MidiUSBHLast)
 #endif
 
 // Serial0
@@ -153,7 +195,31 @@ MIDI_CREATE_INSTANCE(HardwareSerial, Serial2, serial2Midi);
 
 
 //-------------- Private Function Prototypes --------------//
-void midi_HandleThruRouting(uint8_t* interfacePtr, MidiType type, Channel channel, DataByte data1, DataByte data2);
+void midi_PostMessage(uint8_t source, MidiType type, Channel channel, DataByte data1, DataByte data2);
+void midi_PostEvent(uint8_t source, MidiEvent* event);
+void midi_PostSysEx(uint8_t source, const uint8_t* array, unsigned size);
+void midi_QueueSysExPacket(uint8_t source, uint8_t form);
+uint8_t midi_QueueEvent(uint8_t source, const MidiEvent* event);
+void midi_RouteEvents();
+uint8_t midi_RouteNext();
+uint8_t midi_CanRoute(uint8_t source, const MidiEvent* event);
+uint8_t midi_SharesDestination(const uint8_t* row, const uint8_t* other);
+void midi_EndRoutedSysEx();
+void midi_RouteEvent(uint8_t* interfacePtr, MidiEvent* event);
+uint8_t* midi_ThruRow(uint8_t source);
+#ifdef USE_BLE_MIDI
+void midi_WriteBLE(MidiEvent* event);
+#endif
+#ifdef USE_WIFI_RTP_MIDI
+void midi_WriteRTP(MidiEvent* event);
+#endif
+uint8_t** midi_ThruHandlesPtr(uint8_t interface);
+void midi_UseThruHandles(const Esp32ManagerSnapshot* snapshot);
+void midi_WaitForPass();
+#ifdef USE_BLE_MIDI
+void midi_ApplyBLEConfig(const Esp32ManagerConfig* previous, const Esp32ManagerConfig* config);
+#endif
+void midi_DispatchControlChange(MidiInterfaceType interface, uint8_t channel, uint8_t number, uint8_t value);
 
 
 // USBD
@@ -167,9 +233,9 @@ void usbdMidi_SysexCallback(uint8_t * array, unsigned size);
 
 // USBH
 #ifdef USE_USBH_MIDI
-void usbhMidi_ControlChangeCallback(uint8_t channel, uint8_t number, uint8_t value);
-void usbhMidi_ProgramChangeCallback(uint8_t channel, uint8_t number);
-void usbhMidi_SysexCallback(uint8_t * array, unsigned size);
+uint8_t midi_StatusByte(MidiType type, Channel channel);
+void usbhMidi_MessageCallback(uint8_t port, uint8_t status, uint8_t data1, uint8_t data2);
+void usbhMidi_SysexCallback(uint8_t port, uint8_t * array, unsigned size);
 #endif
 
 // BLE
@@ -223,7 +289,18 @@ void midi_ProcessTask(void* parameter)
 	//UBaseType_t uxHighWaterMark;
 	while(1)
 	{
+		// Thru changes are only picked up between passes, never part way through a message
+		if(routeOwner == MidiNone)
+		{
+			const Esp32ManagerSnapshot* snapshot = esp32Manager_ConfigSafePoint(Esp32ReaderMidi);
+			if(snapshot != NULL)
+			{
+				midi_UseThruHandles(snapshot);
+			}
+		}
 		midi_ReadAll();
+		midi_RouteEvents();
+		midiPassCount++;
 		//uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL );
 		//ESP_LOGD(TAG, "MIDI Process Task High Water Mark: %d", uxHighWaterMark);
 		vTaskDelay(1);
@@ -234,9 +311,24 @@ void midi_ProcessTask(void* parameter)
 void midi_BleInfoTask(void* parameter)
 {
 	static uint16_t bleProcessCount = 0;
+#ifdef USE_BLE_MIDI
+	Esp32ManagerConfig appliedConfig = *esp32ConfigPtr;
+#endif
+#if defined(USE_LAZY_INIT) && defined(USE_BLE_MIDI)
+	midi_InitBLE();
+	esp32Manager_BootPhase("BLE MIDI started");
+#endif
 	//UBaseType_t uxHighWaterMark;
 	while(1)
 	{
+#ifdef USE_BLE_MIDI
+		const Esp32ManagerSnapshot* snapshot = esp32Manager_ConfigSafePoint(Esp32ReaderBLE);
+		if(snapshot != NULL)
+		{
+			midi_ApplyBLEConfig(&appliedConfig, &snapshot->config);
+			appliedConfig = snapshot->config;
+		}
+#endif
 		if(esp32ConfigPtr->wirelessType != Esp32BLE)
 		{
 			vTaskDelay(1000 / portTICK_PERIOD_MS);
@@ -273,8 +365,10 @@ void midi_Init()
 
 	// USBH
 #ifdef USE_USBH_MIDI
-	numMidiHandles++;
-	//midih_Init();
+	numMidiHandles += USBH_MIDI_MAX_PORTS;
+	midih_Init();
+	midih_AssignMessageCallback(usbhMidi_MessageCallback);
+	midih_AssignSysExCallback(usbhMidi_SysexCallback);
 #endif
 
 	// BLE
@@ -357,35 +451,9 @@ void midi_Init()
 	// Begin MIDI interfaces
 	// USBD
 #ifdef USE_USBD_MIDI
-  	ESP_LOGV(TAG, "Starting USBD MIDI");
-	usbdMidi.begin(MIDI_CHANNEL_OMNI);
-	usbdMidi.turnThruOff();
-	if (TinyUSBDevice.mounted())
-	{
-		TinyUSBDevice.detach();
-		delay(10);
-		TinyUSBDevice.attach();
-  	}
-#endif
-	// BLE
-#ifdef USE_BLE_MIDI
-	if(esp32ConfigPtr->wirelessType == Esp32BLE)
-	{
-		if(esp32ConfigPtr->bleMode == Esp32BLEServer)
-		{
-			ESP_LOGV(TAG, "Starting BLE MIDI Server");
-			blueMidi.begin(MIDI_CHANNEL_OMNI);
-		}
-#ifdef USE_BLE_MIDI_CLIENT
-		else if(esp32ConfigPtr->bleMode == Esp32BLEClient)
-		{
-			ESP_LOGV(TAG, "Starting BLE MIDI Central");
-			blueMidiClient.begin(MIDI_CHANNEL_OMNI);
-		}
-#endif
-		
-	}
+	midi_InitUSBD();
 #endif
+	// BLE is started by midi_InitBLE
 	// Serial0
 #ifdef USE_SERIAL0_MIDI
 	ESP_LOGV(TAG, "Starting Serial0 MIDI");
@@ -408,114 +476,30 @@ void midi_Init()
 	serial2Midi.begin(MIDI_CHANNEL_OMNI);
 #endif
 
-#if !defined(USE_ESP_LINK)
 	midi_ApplyThruSettings();
-#endif
 }
 
+// The library thru is kept off on every port. All thru, including a port back to itself, goes through
+// the router so a message is only forwarded once
 void midi_ApplyThruSettings()
 {
-	// Apply MIDI thru settings
-	// USBD
 #ifdef USE_USBD_MIDI
-	if(usbdMidiThruHandlesPtr != NULL)
-	{
-		if(usbdMidiThruHandlesPtr[MidiUSBD])
-			usbdMidi.turnThruOn();
-		else
-			usbdMidi.turnThruOff();
-	}
-	else
-	{
-		usbdMidi.turnThruOff();
-	}
-#endif
-	// USBH
-#ifdef USE_USBH_MIDI	
-	if(usbhMidiThruHandlesPtr != NULL)
-	{
-		if(usbhMidiThruHandlesPtr[MidiUSBH])
-			usbhMidi.turnThruOn();
-		else
-			usbhMidi.turnThruOff();
-	}
-	else
-	{
-		usbhMidi.turnThruOff();
-	}
+	usbdMidi.turnThruOff();
 #endif
-	// BLE
 #ifdef USE_BLE_MIDI
-	if(bleMidiThruHandlesPtr != NULL)
-	{
-		if(bleMidiThruHandlesPtr[MidiBLE])
-			blueMidi.turnThruOn();
-		else
-			blueMidi.turnThruOff();
-	}
-	else
-	{
-		blueMidi.turnThruOff();
-	}
+	blueMidi.turnThruOff();
 #endif
-	// WiFi
 #ifdef USE_WIFI_RTP_MIDI
-	if(usbhMidiThruHandlesPtr != NULL)
-	{
-		if(wifiMidiThruHandlesPtr[MidiWiFiRTP])
-			rtpMidi.turnThruOn();
-		else
-			rtpMidi.turnThruOff();
-	}
-	else
-	{
-		rtpMidi.turnThruOff();
-	}
+	rtpMidi.turnThruOff();
 #endif
-	// Serial0
 #ifdef USE_SERIAL0_MIDI
-	if(serial0MidiThruHandlesPtr != NULL)
-	{
-		if(serial0MidiThruHandlesPtr[MidiSerial0])
-			serial0Midi.turnThruOn();
-		else 
-			serial0Midi.turnThruOff();
-	}
-	else
-	{
-		serial0Midi.turnThruOff();
-	}
+	serial0Midi.turnThruOff();
 #endif
-#ifdef USE_USE_ESP_LINK
+#if defined(USE_SERIAL1_MIDI) || defined(USE_ESP_LINK)
 	serial1Midi.turnThruOff();
 #endif
-	// Serial1
-#ifdef USE_SERIAL1_MIDI
-	if(serial0MidiThruHandlesPtr != NULL)
-	{
-		if(serial1MidiThruHandlesPtr[MidiSerial1])
-			serial1Midi.turnThruOn();
-		else
-			serial1Midi.turnThruOff();
-	}
-	else
-	{
-		serial1Midi.turnThruOff();
-	}
-#endif
-	// Serial2
 #ifdef USE_SERIAL2_MIDI
-	if(serial2MidiThruHandlesPtr != NULL)
-	{
-		if(serial2MidiThruHandlesPtr[MidiSerial2])
-			serial2Midi.turnThruOn();
-		else
-			serial2Midi.turnThruOff();
-	}
-	else
-	{
-		serial2Midi.turnThruOff();
-	}
+	serial2Midi.turnThruOff();
 #endif
 }
 
@@ -523,7 +507,41 @@ void midi_ApplyThruSettings()
 #ifdef USE_USBD_MIDI
 void midi_InitUSBD()
 {
-	
+  	ESP_LOGV(TAG, "Starting USBD MIDI");
+	usbdMidi.begin(MIDI_CHANNEL_OMNI);
+	usbdMidi.turnThruOff();
+	// Re-enumerate so the host sees the MIDI interface
+	if (TinyUSBDevice.mounted())
+	{
+		TinyUSBDevice.detach();
+		delay(10);
+		TinyUSBDevice.attach();
+  	}
+}
+#endif
+
+#ifdef USE_BLE_MIDI
+void midi_InitBLE()
+{
+	if(esp32ConfigPtr->wirelessType == Esp32BLE)
+	{
+		bleMidiMode = esp32ConfigPtr->bleMode;
+		if(bleMidiMode == Esp32BLEServer)
+		{
+			ESP_LOGV(TAG, "Starting BLE MIDI Server");
+			blueMidi.begin(MIDI_CHANNEL_OMNI);
+			blueMidi.turnThruOff();
+		}
+#ifdef USE_BLE_MIDI_CLIENT
+		else if(bleMidiMode == Esp32BLEClient)
+		{
+			ESP_LOGV(TAG, "Starting BLE MIDI Central");
+			blueMidiClient.begin(MIDI_CHANNEL_OMNI);
+			blueMidiClient.turnThruOff();
+		}
+#endif
+		bleMidiStarted = 1;
+	}
 }
 #endif
 
@@ -548,6 +566,8 @@ void midi_InitWiFiRTP()
 			Serial.print(RTP.getName());
 			Serial.print("\"}}~\n");
 			rtpMidi.begin(MIDI_CHANNEL_OMNI);
+			rtpMidi.turnThruOff();
+			rtpMidiStarted = 1;
 		}
 		else
 		{
@@ -557,6 +577,54 @@ void midi_InitWiFiRTP()
 }
 #endif
 
+#ifdef USE_BLE_MIDI
+// Stops BLE MIDI once the MIDI task is no longer reading it
+void midi_StopBLE()
+{
+	if(!bleMidiStarted)
+	{
+		return;
+	}
+	bleMidiStarted = 0;
+	midi_WaitForPass();
+	bleSysExOpen = 0;
+	turnOffBLE();
+	bleConnected = false;
+	esp32Info.bleConnected = 0;
+	ESP_LOGI(TAG, "BLE MIDI stopped");
+}
+#endif
+
+#ifdef USE_WIFI_RTP_MIDI
+// Stops routing to RTP MIDI before WiFi is disconnected
+void midi_StopWiFiRTP()
+{
+	if(!rtpMidiStarted)
+	{
+		return;
+	}
+	rtpMidiStarted = 0;
+	midi_WaitForPass();
+	rtpSysExOpen = 0;
+	ESP_LOGI(TAG, "RTP MIDI stopped");
+}
+#endif
+
+// Copies the thru handles in use into a config snapshot
+void midi_GetThruHandles(Esp32ManagerSnapshot* snapshot)
+{
+	snapshot->thruSources = 0;
+	for(uint8_t interface = 0; interface < MidiNone; interface++)
+	{
+		uint8_t** handlesPtr = midi_ThruHandlesPtr(interface);
+		if(handlesPtr != NULL && *handlesPtr != NULL)
+		{
+			memcpy(snapshot->thru[interface], *handlesPtr, MidiNone);
+			snapshot->thruSources |= (1 << interface);
+		}
+	}
+}
+
 
 
 void midi_ReadAll()
@@ -566,7 +634,7 @@ void midi_ReadAll()
 	// Thru routing
 	if(usbdMidi.read() && usbdMidiThruHandlesPtr != NULL)
 	{
-		midi_HandleThruRouting(usbdMidiThruHandlesPtr, usbdMidi.getType(), usbdMidi.getChannel(), usbdMidi.getData1(), usbdMidi.getData2());
+		midi_PostMessage(MidiUSBD, usbdMidi.getType(), usbdMidi.getChannel(), usbdMidi.getData1(), usbdMidi.getData2());
 #ifdef USE_ESP_LINK
 		midi_LinkCreateDataPacket(MidiUSBD, usbdMidi.getType(), usbdMidi.getChannel(), usbdMidi.getData1(), usbdMidi.getData2());
 #endif
@@ -574,26 +642,20 @@ void midi_ReadAll()
 #endif
 	// USBH
 #ifdef USE_USBH_MIDI
-	// Thru routing
-	if(usbhMidi.read() && usbhMidiThruHandlesPtr != NULL)
-	{
-		midi_HandleThruRouting(usbhMidiThruHandlesPtr, usbhMidi.getType(), usbhMidi.getChannel(), usbhMidi.getData1(), usbhMidi.getData2());
-#ifdef USE_ESP_LINK
-		midi_LinkCreateDataPacket(MidiUSBH, usbhMidi.getType(), usbhMidi.getChannel(), usbhMidi.getData1(), usbhMidi.getData2());
-#endif
-	}
+	// Received messages and thru routing are handled through the USBH callbacks
+	midih_Process();
 #endif
 
 	// BLE
 #ifdef USE_BLE_MIDI
-	if(esp32ConfigPtr->wirelessType == Esp32BLE && !blockWirelessMidi)
+	if(bleMidiStarted && !blockWirelessMidi)
 	{
-		if(esp32ConfigPtr->bleMode == Esp32BLEServer)
+		if(bleMidiMode == Esp32BLEServer)
 		{
 			// Thru routing
 			if(blueMidi.read() && bleMidiThruHandlesPtr != NULL)
 			{
-				midi_HandleThruRouting(bleMidiThruHandlesPtr, blueMidi.getType(), blueMidi.getChannel(), blueMidi.getData1(), blueMidi.getData2());
+				midi_PostMessage(MidiBLE, blueMidi.getType(), blueMidi.getChannel(), blueMidi.getData1(), blueMidi.getData2());
 #ifdef USE_ESP_LINK
 				midi_LinkCreateDataPacket(MidiBLE, blueMidi.getType(), blueMidi.getChannel(), blueMidi.getData1(), blueMidi.getData2());
 #endif
@@ -605,7 +667,7 @@ void midi_ReadAll()
 			// Thru routing
 			if(blueMidiClient.read() && bleMidiThruHandlesPtr != NULL)
 			{
-				midi_HandleThruRouting(bleMidiThruHandlesPtr, blueMidiClient.getType(), blueMidiClient.getChannel(), blueMidiClient.getData1(), blueMidiClient.getData2());
+				midi_PostMessage(MidiBLE, blueMidiClient.getType(), blueMidiClient.getChannel(), blueMidiClient.getData1(), blueMidiClient.getData2());
 #ifdef USE_ESP_LINK
 				midi_LinkCreateDataPacket(MidiBLE, blueMidiClient.getType(), blueMidiClient.getChannel(), blueMidiClient.getData1(), blueMidiClient.getData2());
 #endif
@@ -617,12 +679,12 @@ void midi_ReadAll()
 #endif
 	// WiFi RTP
 #ifdef USE_WIFI_RTP_MIDI
-	if(esp32ConfigPtr->wirelessType == Esp32WiFi && esp32Info.wifiConnected && !blockWirelessMidi)
+	if(esp32ConfigPtr->wirelessType == Esp32WiFi && esp32Info.wifiConnected && rtpMidiStarted && !blockWirelessMidi)
 	{
 		// Thru routing
 		if(rtpMidi.read() && wifiMidiThruHandlesPtr != NULL)
 		{
-			midi_HandleThruRouting(wifiMidiThruHandlesPtr, rtpMidi.getType(), rtpMidi.getChannel(), rtpMidi.getData1(), rtpMidi.getData2());
+			midi_PostMessage(MidiWiFiRTP, rtpMidi.getType(), rtpMidi.getChannel(), rtpMidi.getData1(), rtpMidi.getData2());
 #ifdef USE_ESP_LINK
 			midi_LinkCreateDataPacket(MidiWiFiRTP, rtpMidi.getType(), rtpMidi.getChannel(), rtpMidi.getData1(), rtpMidi.getData2());
 #endif
@@ -636,7 +698,7 @@ void midi_ReadAll()
 	// Thru routing
 	if(serial0Midi.read() && serial0MidiThruHandlesPtr != NULL)
 	{
-		midi_HandleThruRouting(serial0MidiThruHandlesPtr, serial0Midi.getType(), serial0Midi.getChannel(), serial0Midi.getData1(), serial0Midi.getData2());
+		midi_PostMessage(MidiSerial0, serial0Midi.getType(), serial0Midi.getChannel(), serial0Midi.getData1(), serial0Midi.getData2());
 #ifdef USE_ESP_LINK
 		midi_LinkCreateDataPacket(MidiSerial0, serial0Midi.getType(), serial0Midi.getChannel(), serial0Midi.getData1(), serial0Midi.getData2());
 #endif
@@ -647,7 +709,7 @@ void midi_ReadAll()
 	// Thru routing
 	if(serial1Midi.read() && serial1MidiThruHandlesPtr != NULL)
 	{
-		midi_HandleThruRouting(serial1MidiThruHandlesPtr, serial1Midi.getType(), serial1Midi.getChannel(), serial1Midi.getData1(), serial1Midi.getData2());
+		midi_PostMessage(MidiSerial1, serial1Midi.getType(), serial1Midi.getChannel(), serial1Midi.getData1(), serial1Midi.getData2());
 	}
 #endif
 #ifdef USE_ESP_LINK
@@ -658,7 +720,7 @@ void midi_ReadAll()
 	// Thru routing
 	if(serial2Midi.read() && serial2MidiThruHandlesPtr != NULL)
 	{
-		midi_HandleThruRouting(serial2MidiThruHandlesPtr, serial2Midi.getType(), serial2Midi.getChannel(), serial2Midi.getData1(), serial2Midi.getData2());
+		midi_PostMessage(MidiSerial2, serial2Midi.getType(), serial2Midi.getChannel(), serial2Midi.getData1(), serial2Midi.getData2());
 #ifdef USE_ESP_LINK
 		midi_LinkCreateDataPacket(MidiSerial2, serial2Midi.getType(), serial2Midi.getChannel(), serial2Midi.getData1(), serial2Midi.getData2());
 #endif
@@ -666,52 +728,474 @@ void midi_ReadAll()
 #endif
 }
 
-void midi_HandleThruRouting(uint8_t* interfacePtr, MidiType type, Channel channel, DataByte data1, DataByte data2)
+void midi_PostMessage(uint8_t source, MidiType type, Channel channel, DataByte data1, DataByte data2)
+{
+	MidiEvent event;
+	uint8_t status = type < midi::SystemExclusive ? (type | ((channel - 1) & 0x0F)) : type;
+
+	if(midiEvent_FromMessage(&event, status, data1, data2))
+	{
+		midi_PostEvent(source, &event);
+	}
+}
+
+// Everything is queued behind what the source sent before it. Real time messages are allowed
+// anywhere in a stream, including inside SysEx, so they skip the queue when nothing else from the
+// source is waiting or when they arrive inside the source's own SysEx
+void midi_PostEvent(uint8_t source, MidiEvent* event)
+{
+	uint8_t* interfacePtr = midi_ThruRow(source);
+
+	if(interfacePtr == NULL)
+	{
+		return;
+	}
+	if(midiEvent_IsRealTime(event))
+	{
+		if(midiEventRing_Count(&midiSources[source].ring) == 0 || midiSources[source].sysExOpen)
+		{
+			midi_RouteEvent(interfacePtr, event);
+		}
+		else
+		{
+			midi_QueueEvent(source, event);
+		}
+		return;
+	}
+	// any other status ends a SysEx from the same source
+	if(midiSources[source].sysExOpen)
+	{
+		midi_QueueSysExPacket(source, midiSources[source].sysExStarted ? MIDI_EVENT_SYSEX_END : MIDI_EVENT_SYSEX_COMPLETE);
+	}
+	midi_QueueEvent(source, event);
+}
+
+// Splits a SysEx message, or one of the parts the library hands over for long messages, into
+// SysEx7 packets. Start packets carry 5 bytes and the rest 6, so with the F0 every packet before
+// the end is a whole number of USB packets.
+// The library ends every part but the last with an F0 and starts every part after the first with
+// an F7. Neither marker is data, only an F7 at the end completes the message
+void midi_PostSysEx(uint8_t source, const uint8_t* array, unsigned size)
+{
+	MidiSource* midiSource = &midiSources[source];
+	unsigned start = 0;
+	unsigned end = size;
+	uint8_t complete = 0;
+
+	if(size == 0 || midi_ThruRow(source) == NULL)
+	{
+		return;
+	}
+	if(array[0] == 0xF0)
+	{
+		if(midiSource->sysExOpen)
+		{
+			midi_QueueSysExPacket(source, midiSource->sysExStarted ? MIDI_EVENT_SYSEX_END : MIDI_EVENT_SYSEX_COMPLETE);
+		}
+		midiSource->sysExOpen = 1;
+		start = 1;
+	}
+	else if(!midiSource->sysExOpen)
+	{
+		// the start of this message was never seen, or it timed out
+		return;
+	}
+	else if(array[0] == 0xF7)
+	{
+		start = 1;
+	}
+	if(end > start && array[end - 1] == 0xF7)
+	{
+		end--;
+		complete = 1;
+	}
+	else if(end > start && array[end - 1] == 0xF0)
+	{
+		end--;
+	}
+
+	for(unsigned i = start; i < end; i++)
+	{
+		uint8_t capacity = midiSource->sysExStarted ? MIDI_EVENT_SYSEX_MAX_BYTES : MIDI_EVENT_SYSEX_MAX_BYTES - 1;
+		if(midiSource->carryLength == capacity)
+		{
+			midi_QueueSysExPacket(source, midiSource->sysExStarted ? MIDI_EVENT_SYSEX_CONTINUE : MIDI_EVENT_SYSEX_START);
+		}
+		midiSource->carry[midiSource->carryLength++] = array[i];
+	}
+	if(complete)
+	{
+		midi_QueueSysExPacket(source, midiSource->sysExStarted ? MIDI_EVENT_SYSEX_END : MIDI_EVENT_SYSEX_COMPLETE);
+	}
+}
+
+// Queues the carried SysEx bytes as one packet
+void midi_QueueSysExPacket(uint8_t source, uint8_t form)
+{
+	MidiSource* midiSource = &midiSources[source];
+	MidiEvent event;
+
+	midiEvent_FromSysEx7(&event, form, midiSource->carry, midiSource->carryLength);
+	midiSource->carryLength = 0;
+	midiSource->sysExStarted = form == MIDI_EVENT_SYSEX_START || form == MIDI_EVENT_SYSEX_CONTINUE;
+	midiSource->sysExOpen = midiSource->sysExStarted;
+	midi_QueueEvent(source, &event);
+}
+
+// A full queue is emptied by routing. The packet is only dropped when the queue's oldest packet is
+// waiting on a SysEx from another source that goes to the same interfaces
+uint8_t midi_QueueEvent(uint8_t source, const MidiEvent* event)
+{
+	MidiEventRing* ring = &midiSources[source].ring;
+
+	while(midiEventRing_Count(ring) >= MIDI_EVENT_RING_SIZE && midi_RouteNext());
+	if(!midiEventRing_Push(ring, event))
+	{
+		routeDropped++;
+		ESP_LOGW(TAG, "Route queue for interface %d full, %lu packets dropped", source, routeDropped);
+		return 0;
+	}
+	return 1;
+}
+
+// Routes queued packets, taking one from each source in turn. Once a SysEx has started, other
+// sources only keep routing to interfaces it is not sent to, so SysEx never reaches a destination
+// mixed with other messages
+void midi_RouteEvents()
+{
+	for(uint16_t routed = 0; routed < MIDI_ROUTE_BUDGET; routed++)
+	{
+		if(!midi_RouteNext())
+		{
+			break;
+		}
+	}
+	if(routeOwner != MidiNone && millis() - routeOwnerTime > MIDI_SYSEX_ROUTE_TIMEOUT)
+	{
+		midi_EndRoutedSysEx();
+	}
+}
+
+uint8_t midi_RouteNext()
+{
+	MidiEvent event;
+	uint8_t source = routeNextSource;
+	uint8_t checked;
+
+	for(checked = 0; checked < MidiNone; checked++)
+	{
+		MidiEventRing* ring = &midiSources[source].ring;
+		if(midiEventRing_Peek(ring, &event) && midi_CanRoute(source, &event))
+		{
+			midiEventRing_Pop(ring, &event);
+			break;
+		}
+		if(++source >= MidiNone)
+			source = 0;
+	}
+	if(checked == MidiNone)
+	{
+		return 0;
+	}
+	routeNextSource = source + 1 < MidiNone ? source + 1 : 0;
+
+	if(midiEvent_Type(&event) == MIDI_EVENT_UMP_SYSEX7)
+	{
+		uint8_t form = midiEvent_SysExForm(&event);
+		if((form == MIDI_EVENT_SYSEX_CONTINUE || form == MIDI_EVENT_SYSEX_END) && routeOwner != source)
+		{
+			// left over from a SysEx that timed out
+			return 1;
+		}
+		routeOwner = (form == MIDI_EVENT_SYSEX_START || form == MIDI_EVENT_SYSEX_CONTINUE) ? source : MidiNone;
+		routeOwnerTime = millis();
+	}
+
+	uint8_t* interfacePtr = midi_ThruRow(source);
+	if(interfacePtr != NULL)
+	{
+		midi_RouteEvent(interfacePtr, &event);
+	}
+	return 1;
+}
+
+// While a SysEx is being routed, another source's packet may only go ahead if it is real time, or
+// if it is not SysEx and none of its destinations are part way through receiving the SysEx. Each
+// source stays in order
+uint8_t midi_CanRoute(uint8_t source, const MidiEvent* event)
+{
+	if(routeOwner == MidiNone || source == routeOwner || midiEvent_IsRealTime(event))
+	{
+		return 1;
+	}
+	if(midiEvent_Type(event) == MIDI_EVENT_UMP_SYSEX7)
+	{
+		// a new SysEx waits its turn, the rest of one that timed out is let through to be dropped
+		uint8_t form = midiEvent_SysExForm(event);
+		return form == MIDI_EVENT_SYSEX_CONTINUE || form == MIDI_EVENT_SYSEX_END;
+	}
+	return !midi_SharesDestination(midi_ThruRow(source), midi_ThruRow(routeOwner));
+}
+
+uint8_t midi_SharesDestination(const uint8_t* row, const uint8_t* other)
 {
+	if(row == NULL || other == NULL)
+	{
+		return 0;
+	}
+	for(uint8_t interface = 0; interface < MidiNone; interface++)
+	{
+		if(row[interface] == 1 && other[interface] == 1)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// The rest of a SysEx did not arrive. An empty end packet closes it at every destination
+void midi_EndRoutedSysEx()
+{
+	MidiEvent event;
+	uint8_t source = routeOwner;
+	uint8_t* interfacePtr = midi_ThruRow(source);
+
+	ESP_LOGW(TAG, "SysEx from interface %d timed out", source);
+	routeOwner = MidiNone;
+	midiSources[source].sysExOpen = 0;
+	midiSources[source].sysExStarted = 0;
+	midiSources[source].carryLength = 0;
+	midiEvent_FromSysEx7(&event, MIDI_EVENT_SYSEX_END, NULL, 0);
+	if(interfacePtr != NULL)
+	{
+		midi_RouteEvent(interfacePtr, &event);
+	}
+}
+
+// MIDI 1.0 edge of the router. Each destination copies from the event's cached encodings, so every
+// encoding is built at most once however many ports a packet goes to
+void midi_RouteEvent(uint8_t* interfacePtr, MidiEvent* event)
+{
+#if defined(USE_USBD_MIDI) || defined(USE_USBH_MIDI)
+	uint8_t packetCount;
+	const uint8_t* packets;
+#endif
 #ifdef USE_USBD_MIDI
 	if(interfacePtr[MidiUSBD] == 1)
 	{
-		usbdMidi.send(type, channel, data1, data2);
+		packets = midiEvent_UsbPackets(event, &packetCount);
+		for(uint8_t i = 0; i < packetCount; i++)
+		{
+			usbd_midi.writePacket(&packets[i * 4]);
+		}
 	}
 #endif
 #ifdef USE_USBH_MIDI
-	if(interfacePtr[MidiUSBH] == 1)
+	for(uint8_t port = 0; port < USBH_MIDI_MAX_PORTS; port++)
 	{
-		usbhMidi.send(type, channel, data1, data2);
+		if(interfacePtr[MidiUSBH + port] == 1)
+		{
+			packets = midiEvent_UsbPackets(event, &packetCount);
+			for(uint8_t i = 0; i < packetCount; i++)
+			{
+				midih_SendPacket(port, &packets[i * 4]);
+			}
+		}
 	}
 #endif
 #ifdef USE_BLE_MIDI
-	if(interfacePtr[MidiBLE] == 1)
+	if(interfacePtr[MidiBLE] == 1 && bleMidiStarted)
 	{
-		blueMidi.send(type, channel, data1, data2);
+		midi_WriteBLE(event);
 	}
 #endif
 #ifdef USE_WIFI_RTP_MIDI
-	if(interfacePtr[MidiWiFiRTP] == 1)
+	if(interfacePtr[MidiWiFiRTP] == 1 && rtpMidiStarted)
 	{
-		rtpMidi.send(type, channel, data1, data2);
+		midi_WriteRTP(event);
 	}
 #endif
 #ifdef USE_SERIAL0_MIDI
 	if(interfacePtr[MidiSerial0] == 1)
 	{
-		serial0Midi.send(type, channel, data1, data2);
+		Serial0.write(midiEvent_Bytes(event), midiEvent_Length(event));
 	}
 #endif
 #ifdef USE_SERIAL1_MIDI
 	if(interfacePtr[MidiSerial1] == 1)
 	{
-		serial1Midi.send(type, channel, data1, data2);
+		Serial1.write(midiEvent_Bytes(event), midiEvent_Length(event));
 	}
 #endif
 #ifdef USE_SERIAL2_MIDI
 	if(interfacePtr[MidiSerial2] == 1)
 	{
-		serial2Midi.send(type, channel, data1, data2);
+		Serial2.write(midiEvent_Bytes(event), midiEvent_Length(event));
 	}
 #endif
 }
 
+#ifdef USE_BLE_MIDI
+// A SysEx is written as one transmission from its start packet to its end packet. Real time
+// messages routed meanwhile go inside it after their own timestamp byte, as BLE MIDI allows
+void midi_WriteBLE(MidiEvent* event)
+{
+	const uint8_t* bytes = midiEvent_Bytes(event);
+	uint8_t sysEx = midiEvent_Type(event) == MIDI_EVENT_UMP_SYSEX7;
+	uint8_t form = midiEvent_SysExForm(event);
+
+	if(bleSysExOpen && midiEvent_IsRealTime(event))
+	{
+		BLEblueMidi.write(0x80 | (millis() & 0x7F));
+		BLEblueMidi.write(bytes[0]);
+		return;
+	}
+	if(!sysEx || form == MIDI_EVENT_SYSEX_COMPLETE || form == MIDI_EVENT_SYSEX_START)
+	{
+		if(!BLEblueMidi.beginTransmission((MidiType)midiEvent_Status(event)))
+		{
+			return;
+		}
+	}
+	else if(!bleSysExOpen)
+	{
+		return;
+	}
+	for(uint8_t i = 0; i < midiEvent_Length(event); i++)
+	{
+		BLEblueMidi.write(bytes[i]);
+	}
+	bleSysExOpen = sysEx && (form == MIDI_EVENT_SYSEX_START || form == MIDI_EVENT_SYSEX_CONTINUE);
+	if(!bleSysExOpen)
+	{
+		BLEblueMidi.endTransmission();
+	}
+}
+#endif
+
+#ifdef USE_WIFI_RTP_MIDI
+// As for BLE, real time messages go straight into an open SysEx transmission
+void midi_WriteRTP(MidiEvent* event)
+{
+	const uint8_t* bytes = midiEvent_Bytes(event);
+	uint8_t sysEx = midiEvent_Type(event) == MIDI_EVENT_UMP_SYSEX7;
+	uint8_t form = midiEvent_SysExForm(event);
+
+	if(rtpSysExOpen && midiEvent_IsRealTime(event))
+	{
+		RTP.write(bytes[0]);
+		return;
+	}
+	if(!sysEx || form == MIDI_EVENT_SYSEX_COMPLETE || form == MIDI_EVENT_SYSEX_START)
+	{
+		if(!RTP.beginTransmission((MidiType)midiEvent_Status(event)))
+		{
+			return;
+		}
+	}
+	else if(!rtpSysExOpen)
+	{
+		return;
+	}
+	for(uint8_t i = 0; i < midiEvent_Length(event); i++)
+	{
+		RTP.write(bytes[i]);
+	}
+	rtpSysExOpen = sysEx && (form == MIDI_EVENT_SYSEX_START || form == MIDI_EVENT_SYSEX_CONTINUE);
+	if(!rtpSysExOpen)
+	{
+		RTP.endTransmission();
+	}
+}
+#endif
+
+uint8_t* midi_ThruRow(uint8_t source)
+{
+	uint8_t** handlesPtr = midi_ThruHandlesPtr(source);
+	return handlesPtr == NULL ? NULL : *handlesPtr;
+}
+
+uint8_t** midi_ThruHandlesPtr(uint8_t interface)
+{
+#ifdef USE_USBH_MIDI
+	if(MIDI_IS_USBH(interface))
+	{
+		return &usbhMidiThruHandlesPtr[interface - MidiUSBH];
+	}
+#endif
+	switch(interface)
+	{
+#ifdef USE_USBD_MIDI
+		case MidiUSBD:
+			return &usbdMidiThruHandlesPtr;
+#endif
+#ifdef USE_BLE_MIDI
+		case MidiBLE:
+			return &bleMidiThruHandlesPtr;
+#endif
+#ifdef USE_WIFI_RTP_MIDI
+		case MidiWiFiRTP:
+			return &wifiMidiThruHandlesPtr;
+#endif
+#ifdef USE_SERIAL0_MIDI
+		case MidiSerial0:
+			return &serial0MidiThruHandlesPtr;
+#endif
+#if defined(USE_SERIAL1_MIDI) || defined(USE_ESP_LINK)
+		case MidiSerial1:
+			return &serial1MidiThruHandlesPtr;
+#endif
+#ifdef USE_SERIAL2_MIDI
+		case MidiSerial2:
+			return &serial2MidiThruHandlesPtr;
+#endif
+		default:
+			return NULL;
+	}
+}
+
+// Routes from the thru rows of a newly published snapshot. Only called from the MIDI task
+void midi_UseThruHandles(const Esp32ManagerSnapshot* snapshot)
+{
+	for(uint8_t interface = 0; interface < MidiNone; interface++)
+	{
+		uint8_t** handlesPtr = midi_ThruHandlesPtr(interface);
+		if(handlesPtr != NULL)
+		{
+			*handlesPtr = (snapshot->thruSources & (1 << interface)) ? (uint8_t*)snapshot->thru[interface] : NULL;
+		}
+	}
+	midi_ApplyThruSettings();
+	ESP_LOGI(TAG, "Thru handles from config version %lu", snapshot->version);
+}
+
+// Waits for the MIDI task to start and finish a pass
+void midi_WaitForPass()
+{
+	uint32_t start = midiPassCount;
+	for(uint8_t waited = 0; waited < 100 && midiPassCount - start < 2; waited++)
+	{
+		vTaskDelay(1 / portTICK_PERIOD_MS);
+	}
+}
+
+#ifdef USE_BLE_MIDI
+// Restarts BLE MIDI only if the change affects it
+void midi_ApplyBLEConfig(const Esp32ManagerConfig* previous, const Esp32ManagerConfig* config)
+{
+	uint8_t changed = previous->bleMode != config->bleMode || previous->bleFilterMode != config->bleFilterMode;
+
+	if(config->wirelessType != Esp32BLE || changed)
+	{
+		midi_StopBLE();
+	}
+	if(config->wirelessType == Esp32BLE && !bleMidiStarted)
+	{
+		midi_InitBLE();
+	}
+}
+#endif
+
 // Global MIDI callback assignment functions
 void midi_AssignControlChangeCallback(void (*callback)(MidiInterfaceType interface, uint8_t channel, uint8_t number, uint8_t value))
 {
@@ -777,6 +1261,19 @@ void midi_SendDeviceApiSysExString(const char* array, unsigned size, uint8_t con
 #endif
 }
 
+// Common handling of CC messages received on any interface
+void midi_DispatchControlChange(MidiInterfaceType interface, uint8_t channel, uint8_t number, uint8_t value)
+{
+#ifdef USE_TONEX_ONE
+	tonexOne_HandleMidiControlChange(channel, number, value);
+#endif
+	// Application specific callback
+	if (mControlChangeCallback != nullptr)
+	{
+		mControlChangeCallback(interface, channel, number, value);
+	}
+}
+
 // Process SysEx data received on any interface.
 void processSysEx(MidiInterfaceType interface, uint8_t* array, unsigned size)
 {
@@ -900,8 +1397,8 @@ void midi_SendMessage(MidiInterfaceType interface, MidiType type, uint8_t channe
 		usbdMidi.send(type, data1, data2, channel);
 #endif
 #ifdef USE_USBH_MIDI
-	if(interface == MidiUSBH)
-		usbdMidi.send(type, data1, data2, channel);
+	if(MIDI_IS_USBH(interface))
+		midih_SendMessage(interface - MidiUSBH, midi_StatusByte(type, channel), data1, data2);
 #endif
 #ifdef USE_BLE_MIDI
 	if(interface == MidiBLE)
@@ -932,15 +1429,15 @@ void midi_SendControlChange(MidiInterfaceType interface, uint8_t channel, uint8_
 		usbdMidi.sendControlChange(channel, number, value);
 #endif
 #ifdef USE_USBH_MIDI
-	if(interface == MidiUSBH)
-		usbhMidi.sendControlChange(channel, number, value);
+	if(MIDI_IS_USBH(interface))
+		midih_SendMessage(interface - MidiUSBH, midi_StatusByte(midi::ControlChange, channel), number, value);
 #endif
 #ifdef USE_BLE_MIDI
-	if(interface == MidiBLE)
+	if(interface == MidiBLE && bleMidiStarted)
 		blueMidi.sendControlChange(channel, number, value);
 #endif
 #ifdef USE_WIFI_RTP_MIDI
-	if(interface == MidiWiFiRTP)
+	if(interface == MidiWiFiRTP && rtpMidiStarted)
 		rtpMidi.sendControlChange(channel, number, value);
 #endif
 #ifdef USE_SERIAL0_MIDI
@@ -959,6 +1456,13 @@ void midi_SendControlChange(MidiInterfaceType interface, uint8_t channel, uint8_
 
 void midi_SendSysEx(MidiInterfaceType interface, const uint8_t* array, unsigned size, uint8_t containsFraming)
 {
+#ifdef USE_USBH_MIDI
+	if(MIDI_IS_USBH(interface))
+	{
+		midih_SendSysEx(interface - MidiUSBH, array, size, containsFraming);
+		return;
+	}
+#endif
 #if defined(USE_SERIAL1_MIDI) || defined(USE_ESP_LINK)
 	if(interface == MidiSerial1)
 	{
@@ -1027,7 +1531,7 @@ void midi_LinkTransmitDataPacket(MidiInterfaceType interface, uint8_t* data, uin
 	}
 #endif
 #ifdef USE_USBH_MIDI
-	if(interface == MidiUSBH)
+	if(MIDI_IS_USBH(interface))
 	{
 		packet[1] = LINK_USBH_MIDI_ID;						// MIDI port
 	}
@@ -1086,10 +1590,7 @@ void midi_LinkProcessReceivedData(uint8_t* data, uint16_t size)
 void usbdMidi_ControlChangeCallback(uint8_t channel, uint8_t number, uint8_t value)
 {
 	// Application specific callback
-	if (mControlChangeCallback != nullptr)
-	{
-		mControlChangeCallback(MidiUSBD, channel, number, value);
-	}
+	midi_DispatchControlChange(MidiUSBD, channel, number, value);
 	//ESP_LOGI(TAG, "USBD MIDI CC: Ch: %d, Num: %d, Val: %d\n", channel, number, value);
 
 }
@@ -1107,6 +1608,7 @@ void usbdMidi_ProgramChangeCallback(uint8_t channel, uint8_t number)
 
 void usbdMidi_SysexCallback(uint8_t * array, unsigned size)
 {
+	midi_PostSysEx(MidiUSBD, array, size);
 	processSysEx(MidiUSBD, array, size);
 
 	ESP_LOGI(TAG, "USBD MIDI SysEx: Size: %d\n", size);
@@ -1116,31 +1618,60 @@ void usbdMidi_SysexCallback(uint8_t * array, unsigned size)
 
 // USBH
 #ifdef USE_USBH_MIDI
-void usbhMidi_ControlChangeCallback(uint8_t channel, uint8_t number, uint8_t value)
+uint8_t midi_StatusByte(MidiType type, Channel channel)
 {
-	if (mControlChangeCallback != nullptr)
+	if(type < midi::SystemExclusive)
 	{
-		mControlChangeCallback(MidiUSBH, channel, number, value);
+		return type | ((channel - 1) & 0x0F);
 	}
-	ESP_LOGI(TAG, "USBH MIDI CC: Ch: %d, Num: %d, Val: %d\n", channel, number, value);
+	return type;
 }
 
-void usbhMidi_ProgramChangeCallback(uint8_t channel, uint8_t number)
+void usbhMidi_MessageCallback(uint8_t port, uint8_t status, uint8_t data1, uint8_t data2)
 {
-	if (mProgramChangeCallback != nullptr)
+	MidiInterfaceType interface = (MidiInterfaceType)(MidiUSBH + port);
+	MidiType type = (MidiType)status;
+	Channel channel = 0;
+
+	if(status < midi::SystemExclusive)
+	{
+		type = (MidiType)(status & 0xF0);
+		channel = (status & 0x0F) + 1;
+	}
+
+	// Thru routing
+	MidiEvent event;
+	if(midiEvent_FromMessage(&event, status, data1, data2))
 	{
-		mProgramChangeCallback(MidiUSBH, channel, number);
+		midi_PostEvent(interface, &event);
+	}
+#ifdef USE_ESP_LINK
+	midi_LinkCreateDataPacket(interface, type, channel, data1, data2);
+#endif
+
+	if(type == midi::ControlChange)
+	{
+		midi_DispatchControlChange(interface, channel, data1, data2);
+		ESP_LOGI(TAG, "USBH MIDI CC: Port: %d, Ch: %d, Num: %d, Val: %d\n", port, channel, data1, data2);
+	}
+	else if(type == midi::ProgramChange)
+	{
+		if (mProgramChangeCallback != nullptr)
+		{
+			mProgramChangeCallback(interface, channel, data1);
+		}
+		ESP_LOGI(TAG, "USBH MIDI PC: Port: %d, Ch: %d, Num: %d\n", port, channel, data1);
 	}
-	ESP_LOGI(TAG, "USBH MIDI PC: Ch: %d, Num: %d\n", channel, number);
 }
 
-void usbhMidi_SysexCallback(uint8_t * array, unsigned size)
+void usbhMidi_SysexCallback(uint8_t port, uint8_t * array, unsigned size)
 {
+	midi_PostSysEx(MidiUSBH + port, array, size);
 	if (mSystemExclusiveCallback != nullptr)
 	{
-		mSystemExclusiveCallback(MidiUSBH, array, size);
+		mSystemExclusiveCallback((MidiInterfaceType)(MidiUSBH + port), array, size);
 	}
-	ESP_LOGI(TAG, "USBH MIDI SysEx: Size: %d\n", size);
+	ESP_LOGI(TAG, "USBH MIDI SysEx: Port: %d, Size: %d\n", port, size);
 
 }
 #endif
@@ -1149,10 +1680,7 @@ void usbhMidi_SysexCallback(uint8_t * array, unsigned size)
 #ifdef USE_BLE_MIDI
 void blueMidi_ControlChangeCallback(uint8_t channel, uint8_t number, uint8_t value)
 {
-	if (mControlChangeCallback != nullptr)
-	{
-		mControlChangeCallback(MidiBLE, channel, number, value);
-	}
+	midi_DispatchControlChange(MidiBLE, channel, number, value);
 	//ESP_LOGI(TAG, "BLE MIDI CC: Ch: %d, Num: %d, Val: %d\n", channel, number, value);
 }
 
@@ -1167,6 +1695,7 @@ void blueMidi_ProgramChangeCallback(uint8_t channel, uint8_t number)
 
 void blueMidi_SysexCallback(uint8_t * array, unsigned size)
 {
+	midi_PostSysEx(MidiBLE, array, size);
 	processSysEx(MidiBLE, array, size);
 	if (mSystemExclusiveCallback != nullptr)
 	{
@@ -1179,6 +1708,7 @@ void turnOnBLE()
 {
 	bleEnabled = 1;
 	blueMidi.begin();
+	blueMidi.turnThruOff();
 }
 
 void turnOffBLE()
@@ -1209,10 +1739,7 @@ void blueMidi_OnDisconnected()
 #ifdef USE_WIFI_RTP_MIDI
 void rtpMidi_ControlChangeCallback(uint8_t channel, uint8_t number, uint8_t value)
 {
-	if (mControlChangeCallback != nullptr)
-	{
-		mControlChangeCallback(MidiWiFiRTP, channel, number, value);
-	}
+	midi_DispatchControlChange(MidiWiFiRTP, channel, number, value);
 #if(CORE_DEBUG_LEVEL >= 4)
 	Serial.printf("WiFi RTP MIDI CC: Ch: %d, Num: %d, Val: %d\n", channel, number, value);
 #endif
@@ -1231,6 +1758,7 @@ void rtpMidi_ProgramChangeCallback(uint8_t channel, uint8_t number)
 
 void rtpMidi_SysexCallback(uint8_t * array, unsigned size)
 {
+	midi_PostSysEx(MidiWiFiRTP, array, size);
 	processSysEx(MidiWiFiRTP, array, size);
 	if (mSystemExclusiveCallback != nullptr)
 	{
@@ -1246,10 +1774,7 @@ void rtpMidi_SysexCallback(uint8_t * array, unsigned size)
 #ifdef USE_SERIAL0_MIDI
 void serial0Midi_ControlChangeCallback(uint8_t channel, uint8_t number, uint8_t value)
 {
-	if (mControlChangeCallback != nullptr)
-	{
-		mControlChangeCallback(MidiSerial0, channel, number, value);
-	}
+	midi_DispatchControlChange(MidiSerial0, channel, number, value);
 #if(CORE_DEBUG_LEVEL >= 4)
 	Serial.printf("Serial0 MIDI CC: Ch: %d, Num: %d, Val: %d\n", channel, number, value);
 #endif
@@ -1268,6 +1793,7 @@ void serial0Midi_ProgramChangeCallback(uint8_t channel, uint8_t number)
 
 void serial0Midi_SysexCallback(uint8_t * array, unsigned size)
 {
+	midi_PostSysEx(MidiSerial0, array, size);
 	if (mSystemExclusiveCallback != nullptr)
 	{
 		mSystemExclusiveCallback(MidiSerial0, array, size);
@@ -1282,10 +1808,7 @@ void serial0Midi_SysexCallback(uint8_t * array, unsigned size)
 #ifdef USE_SERIAL1_MIDI
 void serial1Midi_ControlChangeCallback(uint8_t channel, uint8_t number, uint8_t value)
 {
-	if (mControlChangeCallback != nullptr)
-	{
-		mControlChangeCallback(MidiSerial1, channel, number, value);
-	}
+	midi_DispatchControlChange(MidiSerial1, channel, number, value);
 #if(CORE_DEBUG_LEVEL >= 4)
 	Serial.printf("Serial1 MIDI CC: Ch: %d, Num: %d, Val: %d\n", channel, number, value);
 #endif
@@ -1304,6 +1827,7 @@ void serial1Midi_ProgramChangeCallback(uint8_t channel, uint8_t number)
 
 void serial1Midi_SysexCallback(uint8_t * array, unsigned size)
 {
+	midi_PostSysEx(MidiSerial1, array, size);
 	if (mSystemExclusiveCallback != nullptr)
 	{
 		mSystemExclusiveCallback(MidiSerial1, array, size);
@@ -1317,10 +1841,7 @@ void serial1Midi_SysexCallback(uint8_t * array, unsigned size)
 #ifdef USE_ESP_LINK
 void serial1Midi_ControlChangeCallback(uint8_t channel, uint8_t number, uint8_t value)
 {
-	if (mControlChangeCallback != nullptr)
-	{
-		mControlChangeCallback(MidiSerial1, channel, number, value);
-	}
+	midi_DispatchControlChange(MidiSerial1, channel, number, value);
 #if(CORE_DEBUG_LEVEL >= 4)
 	Serial.printf("Serial1 MIDI CC: Ch: %d, Num: %d, Val: %d\n", channel, number, value);
 #endif
@@ -1354,10 +1875,7 @@ void serial1Midi_SysexCallback(uint8_t * array, unsigned size)
 #ifdef USE_SERIAL2_MIDI
 void serial2Midi_ControlChangeCallback(uint8_t channel, uint8_t number, uint8_t value)
 {
-	if (mControlChangeCallback != nullptr)
-	{
-		mControlChangeCallback(MidiSerial2, channel, number, value);
-	}
+	midi_DispatchControlChange(MidiSerial2, channel, number, value);
 #if(CORE_DEBUG_LEVEL >= 4)
 	Serial.printf("Serial2 MIDI CC: Ch: %d, Num: %d, Val: %d\n", channel, number, value);
 #endif
@@ -1376,6 +1894,7 @@ void serial2Midi_ProgramChangeCallback(uint8_t channel, uint8_t number)
 
 void serial2Midi_SysexCallback(uint8_t * array, unsigned size)
 {
+	midi_PostSysEx(MidiSerial2, array, size);
 	if (mSystemExclusiveCallback != nullptr)
 	{
 		mSystemExclusiveCallback(MidiSerial2, array, size);
@@ -5,6 +5,10 @@
 
 #include "stdint.h"
 #include "MIDI.h"
+#include "esp32_manager.h"
+#ifdef USE_USBH_MIDI
+#include "usbh_midi_handling.h"
+#endif
 
 #define SYSEX_ADDRESS_BYTE1 			0x00
 #define SYSEX_ADDRESS_BYTE2			0x22
@@ -21,6 +25,7 @@ typedef enum
 #endif
 #ifdef USE_USBH_MIDI
 	MidiUSBH,
+	MidiUSBHLast = MidiUSBH + USBH_MIDI_MAX_PORTS - 1,
 #endif
 #ifdef USE_BLE_MIDI
 	MidiBLE,
@@ -54,8 +59,12 @@ void midi_BleInfoTask(void* parameter);
 
 void midi_Init();
 void midi_InitUSBD();
+void midi_InitBLE();
 void midi_InitWiFiRTP();
 void midi_ApplyThruSettings();
+void midi_GetThruHandles(Esp32ManagerSnapshot* snapshot);
+void midi_StopBLE();
+void midi_StopWiFiRTP();
 void midi_ReadAll();
 //uint8_t midi_BleConnected();
 
@@ -71,7 +80,9 @@ extern uint8_t bleEnabled;
 
 extern uint8_t numMidiHandles;
 extern uint8_t* usbdMidiThruHandlesPtr;
-extern uint8_t* usbhMidiThruHandlesPtr;
+#ifdef USE_USBH_MIDI
+extern uint8_t* usbhMidiThruHandlesPtr[USBH_MIDI_MAX_PORTS];		// one thru row per USB host port
+#endif
 extern uint8_t* bleMidiThruHandlesPtr;
 extern uint8_t* wifiMidiThruHandlesPtr;
 extern uint8_t* serial0MidiThruHandlesPtr;
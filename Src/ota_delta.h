@@ -0,0 +1,287 @@
+#pragma once
+#include <Arduino.h>
+#include <Update.h>
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "mbedtls/sha256.h"
+
+// Streaming applier for delta images made with tools/ota_delta.py.
+//
+// A patch is a 76 byte header followed by operations that rebuild the new image from the running one:
+//   "EDP1" | old size (u32 LE) | new size (u32 LE) | old SHA-256 | new SHA-256
+//   0x00              end of patch
+//   0x01 <len>        copy len bytes from the running image
+//   0x02 <len> data   add each data byte to the next running image byte
+//   0x03 <len> data   insert len new bytes, the running image position does not move
+//   0x04 <delta>      move the running image position by a zigzag encoded delta
+// Lengths are LEB128 varints. Patch bytes can be fed in any split, the output goes to Update.write
+#define OTA_DELTA_WINDOW_SIZE   4096
+#define OTA_DELTA_HEADER_SIZE   76
+
+class OTADeltaPatcher
+{
+public:
+    enum Operation { OP_END = 0, OP_COPY = 1, OP_ADD = 2, OP_INSERT = 3, OP_SEEK = 4 };
+
+    /// @brief Prepare to apply a patch to the running partition
+    /// @param sha Hash updated with every byte of the new image
+    /// @return false if the buffers could not be allocated
+    bool Begin(mbedtls_sha256_context* sha)
+    {
+        Sha = sha;
+        Source = esp_ota_get_running_partition();
+        State = HEADER;
+        HeaderLength = 0;
+        OldPos = 0;
+        WindowStart = 0;
+        WindowLength = 0;
+        OutLength = 0;
+        OutCount = 0;
+        Error = NULL;
+        Window = Allocate();
+        Out = Allocate();
+        return Source != NULL && Window != NULL && Out != NULL;
+    }
+
+    bool Write(const uint8_t* data, size_t length)
+    {
+        for (size_t i = 0; i < length; i++)
+        {
+            if (!Process(data[i]))
+                return false;
+        }
+        return true;
+    }
+
+    /// @brief Flush the last output and check the whole image was produced
+    bool End()
+    {
+        if (State != DONE)
+            return Fail("Patch truncated");
+        if (!Flush())
+            return false;
+        if (OutCount != NewSize)
+            return Fail("Patch output size mismatch");
+        return true;
+    }
+
+    void Free()
+    {
+        free(Window);
+        free(Out);
+        Window = NULL;
+        Out = NULL;
+    }
+
+    const char* GetError()
+    {
+        return Error;
+    }
+
+    /// @brief The new image digest from the patch header, as 64 hex characters
+    void GetNewDigest(char* hex)
+    {
+        for (uint8_t i = 0; i < 32; i++)
+            sprintf(&hex[i * 2], "%02x", Header[44 + i]);
+    }
+
+private:
+    enum ParseState { HEADER, OPCODE, ARGUMENT, DATA, DONE, FAILED };
+
+    const esp_partition_t* Source = NULL;
+    mbedtls_sha256_context* Sha = NULL;
+    ParseState State = HEADER;
+    uint8_t Header[OTA_DELTA_HEADER_SIZE];
+    uint8_t HeaderLength = 0;
+    uint8_t Opcode = OP_END;
+    uint32_t Argument = 0;
+    uint8_t ArgumentShift = 0;
+    uint32_t OldSize = 0;
+    uint32_t NewSize = 0;
+    uint32_t OldPos = 0;
+    uint8_t* Window = NULL;             // cached part of the running image
+    uint32_t WindowStart = 0;
+    uint32_t WindowLength = 0;
+    uint8_t* Out = NULL;
+    uint32_t OutLength = 0;
+    uint32_t OutCount = 0;
+    const char* Error = NULL;
+
+    static uint8_t* Allocate()
+    {
+        uint8_t* buffer = (uint8_t*)heap_caps_malloc(OTA_DELTA_WINDOW_SIZE, MALLOC_CAP_SPIRAM);
+        if (buffer == NULL)
+            buffer = (uint8_t*)malloc(OTA_DELTA_WINDOW_SIZE);
+        return buffer;
+    }
+
+    bool Fail(const char* error)
+    {
+        if (Error == NULL)
+            Error = error;
+        State = FAILED;
+        return false;
+    }
+
+    bool Process(uint8_t byte)
+    {
+        switch (State)
+        {
+        case HEADER:
+            Header[HeaderLength++] = byte;
+            if (HeaderLength == OTA_DELTA_HEADER_SIZE)
+                return ParseHeader();
+            return true;
+
+        case OPCODE:
+            Opcode = byte;
+            Argument = 0;
+            ArgumentShift = 0;
+            if (Opcode == OP_END)
+            {
+                State = DONE;
+                return true;
+            }
+            if (Opcode > OP_SEEK)
+                return Fail("Unknown patch operation");
+            State = ARGUMENT;
+            return true;
+
+        case ARGUMENT:
+            if (ArgumentShift > 28)
+                return Fail("Bad patch argument");
+            Argument |= (uint32_t)(byte & 0x7F) << ArgumentShift;
+            ArgumentShift += 7;
+            if (byte & 0x80)
+                return true;
+            return Execute();
+
+        case DATA:
+            if (Opcode == OP_ADD)
+            {
+                uint8_t old;
+                if (!ReadOld(old))
+                    return false;
+                byte += old;
+            }
+            if (!Emit(byte))
+                return false;
+            if (--Argument == 0)
+                State = OPCODE;
+            return true;
+
+        case DONE:
+            return Fail("Data after end of patch");
+
+        default:
+            return false;
+        }
+    }
+
+    bool ParseHeader()
+    {
+        uint8_t digest[32];
+        mbedtls_sha256_context oldSha;
+
+        if (memcmp(Header, "EDP1", 4) != 0)
+            return Fail("Not a delta patch");
+        memcpy(&OldSize, &Header[4], sizeof(OldSize));
+        memcpy(&NewSize, &Header[8], sizeof(NewSize));
+        if (OldSize > Source->size)
+            return Fail("Patch base larger than the running partition");
+
+        // the patch only applies to the exact image it was made from
+        mbedtls_sha256_init(&oldSha);
+        mbedtls_sha256_starts(&oldSha, 0);
+        for (uint32_t offset = 0; offset < OldSize; offset += OTA_DELTA_WINDOW_SIZE)
+        {
+            uint32_t length = min((uint32_t)OTA_DELTA_WINDOW_SIZE, OldSize - offset);
+            if (esp_partition_read(Source, offset, Window, length) != ESP_OK)
+            {
+                mbedtls_sha256_free(&oldSha);
+                return Fail("Running partition read failed");
+            }
+            mbedtls_sha256_update(&oldSha, Window, length);
+        }
+        mbedtls_sha256_finish(&oldSha, digest);
+        mbedtls_sha256_free(&oldSha);
+        WindowLength = 0;
+        if (memcmp(digest, &Header[12], sizeof(digest)) != 0)
+            return Fail("Patch is not for the running firmware");
+
+        State = OPCODE;
+        return true;
+    }
+
+    bool Execute()
+    {
+        State = OPCODE;
+        switch (Opcode)
+        {
+        case OP_COPY:
+            for (; Argument > 0; Argument--)
+            {
+                uint8_t old;
+                if (!ReadOld(old) || !Emit(old))
+                    return false;
+            }
+            return true;
+
+        case OP_SEEK:
+        {
+            int32_t delta = (int32_t)(Argument >> 1) ^ -(int32_t)(Argument & 1);
+            int64_t position = (int64_t)OldPos + delta;
+            if (position < 0 || position > OldSize)
+                return Fail("Patch seeks outside the running image");
+            OldPos = (uint32_t)position;
+            return true;
+        }
+
+        default:
+            if (Argument > 0)
+                State = DATA;
+            return true;
+        }
+    }
+
+    bool ReadOld(uint8_t& byte)
+    {
+        if (OldPos >= OldSize)
+            return Fail("Patch reads past the running image");
+        if (OldPos < WindowStart || OldPos >= WindowStart + WindowLength)
+        {
+            WindowStart = OldPos;
+            WindowLength = min((uint32_t)OTA_DELTA_WINDOW_SIZE, OldSize - OldPos);
+            if (esp_partition_read(Source, WindowStart, Window, WindowLength) != ESP_OK)
+            {
+                WindowLength = 0;
+                return Fail("Running partition read failed");
+            }
+        }
+        byte = Window[OldPos - WindowStart];
+        OldPos++;
+        return true;
+    }
+
+    bool Emit(uint8_t byte)
+    {
+        if (OutCount >= NewSize)
+            return Fail("Patch output larger than the new image");
+        Out[OutLength++] = byte;
+        OutCount++;
+        if (OutLength == OTA_DELTA_WINDOW_SIZE)
+            return Flush();
+        return true;
+    }
+
+    bool Flush()
+    {
+        if (OutLength == 0)
+            return true;
+        if (Update.write(Out, OutLength) != OutLength)
+            return Fail("Flash write failed");
+        mbedtls_sha256_update(Sha, Out, OutLength);
+        OutLength = 0;
+        return true;
+    }
+};
@@ -30,6 +30,134 @@ SOFTWARE.
 #include <ArduinoJson.h>
 #include <Update.h>
 #include <WiFi.h>
+#include "mbedtls/sha256.h"
+#include "ota_delta.h"
+#include <Preferences.h>
+#include "esp32_manager_task_priorities.h"
+
+// Download and flash write run on separate tasks, passing these buffers between them
+#ifndef OTA_PULL_BUFFER_COUNT
+#define OTA_PULL_BUFFER_COUNT   4
+#endif
+#ifndef OTA_PULL_BUFFER_SIZE
+#define OTA_PULL_BUFFER_SIZE    16384
+#endif
+#define OTA_PULL_STALL_TIMEOUT  15000   // ms without data before the connection is dropped and resumed
+#define OTA_PULL_MAX_RESUMES    5       // consecutive resume attempts without receiving data
+#define OTA_PULL_NVS_NAMESPACE  "ota_pull"
+#define OTA_PULL_FLASH_SLICE    4096    // bytes written between flash budget checks
+
+// Dotted numeric version with an optional leading 'v' and pre-release suffix, e.g. v1.2.10-beta.1.
+// Up to four components are compared numerically, missing ones count as 0. A pre-release sorts
+// before its release and is compared per semver, one dot separated identifier at a time with
+// numeric identifiers compared as numbers. "+build" metadata is ignored
+struct OTAVersion
+{
+    uint32_t Parts[4] = { 0, 0, 0, 0 };
+    const char* PreRelease = "";
+    size_t PreReleaseLength = 0;
+
+    static OTAVersion Parse(const char* text)
+    {
+        OTAVersion version;
+        if (*text == 'v' || *text == 'V')
+            text++;
+        for (uint8_t i = 0; i < 4 && isdigit((unsigned char)*text); i++)
+        {
+            char* end;
+            version.Parts[i] = strtoul(text, &end, 10);
+            text = end;
+            if (*text != '.')
+                break;
+            text++;
+        }
+        if (*text == '-')
+        {
+            version.PreRelease = text + 1;
+            version.PreReleaseLength = strcspn(version.PreRelease, "+");
+        }
+        return version;
+    }
+
+    int Compare(const OTAVersion& other) const
+    {
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            if (Parts[i] != other.Parts[i])
+                return Parts[i] < other.Parts[i] ? -1 : 1;
+        }
+        if (PreReleaseLength == 0 || other.PreReleaseLength == 0)
+            return (PreReleaseLength == 0) - (other.PreReleaseLength == 0);
+
+        const char* a = PreRelease;
+        const char* aEnd = PreRelease + PreReleaseLength;
+        const char* b = other.PreRelease;
+        const char* bEnd = other.PreRelease + other.PreReleaseLength;
+        while (a < aEnd && b < bEnd)
+        {
+            size_t aLength = IdentifierLength(a, aEnd);
+            size_t bLength = IdentifierLength(b, bEnd);
+            int result = CompareIdentifier(a, aLength, b, bLength);
+            if (result != 0)
+                return result;
+            a += aLength + 1;
+            b += bLength + 1;
+        }
+        // a shorter list of otherwise equal identifiers sorts first
+        return (a < aEnd) - (b < bEnd);
+    }
+
+    static int Compare(const char* a, const char* b)
+    {
+        return Parse(a).Compare(Parse(b));
+    }
+
+private:
+    static size_t IdentifierLength(const char* identifier, const char* end)
+    {
+        const char* dot = (const char*)memchr(identifier, '.', end - identifier);
+        return (dot == NULL ? end : dot) - identifier;
+    }
+
+    static bool IsNumeric(const char* identifier, size_t length)
+    {
+        for (size_t i = 0; i < length; i++)
+        {
+            if (!isdigit((unsigned char)identifier[i]))
+                return false;
+        }
+        return length > 0;
+    }
+
+    // Numeric identifiers compare as numbers and sort before alphanumeric ones, which compare in ASCII order
+    static int CompareIdentifier(const char* a, size_t aLength, const char* b, size_t bLength)
+    {
+        bool aNumeric = IsNumeric(a, aLength);
+        bool bNumeric = IsNumeric(b, bLength);
+        if (aNumeric != bNumeric)
+            return aNumeric ? -1 : 1;
+        if (aNumeric)
+        {
+            // leading zeros do not change the value
+            while (aLength > 1 && *a == '0')
+            {
+                a++;
+                aLength--;
+            }
+            while (bLength > 1 && *b == '0')
+            {
+                b++;
+                bLength--;
+            }
+            if (aLength != bLength)
+                return aLength < bLength ? -1 : 1;
+        }
+        int result = memcmp(a, b, aLength < bLength ? aLength : bLength);
+        if (result != 0)
+            return result < 0 ? -1 : 1;
+        return (aLength > bLength) - (aLength < bLength);
+    }
+};
 
 class ESP32OTAPull
 {
@@ -37,7 +165,17 @@ public:
     enum ActionType { DONT_DO_UPDATE, UPDATE_BUT_NO_BOOT, UPDATE_AND_BOOT };
 
     // Return codes from CheckForOTAUpdate
-    enum ErrorCode { UPDATE_AVAILABLE = -3, NO_UPDATE_PROFILE_FOUND = -2, NO_UPDATE_AVAILABLE = -1, UPDATE_OK = 0, HTTP_FAILED = 1, WRITE_ERROR = 2, JSON_PROBLEM = 3, OTA_UPDATE_FAIL = 4 };
+    enum ErrorCode { UPDATE_AVAILABLE = -3, NO_UPDATE_PROFILE_FOUND = -2, NO_UPDATE_AVAILABLE = -1, UPDATE_OK = 0, HTTP_FAILED = 1, WRITE_ERROR = 2, JSON_PROBLEM = 3, OTA_UPDATE_FAIL = 4, VERIFY_FAILED = 5 };
+
+    // Timing of the last update. networkMs is time spent receiving, flashMs time spent in Update.write
+    struct TransferStats
+    {
+        uint32_t bytes;
+        uint32_t elapsedMs;
+        uint32_t networkMs;
+        uint32_t flashMs;
+        uint32_t bytesPerSecond;
+    };
 
 private:
     void (*Callback)(int offset, int totallength) = NULL;
@@ -47,28 +185,233 @@ private:
     String Config = "";
     String CVersion = "";
     bool DowngradesAllowed = false;
-
-    int DownloadJson(const char* URL, String& payload)
+    bool DeltaAllowed = true;
+    bool ManifestCaching = true;
+    uint32_t FlashBudget = 0;           // bytes/s, 0 for no limit
+    uint32_t PaceStart = 0;
+
+    // Requests the manifest. HTTP/1.0 avoids chunked encoding so the body can be parsed straight
+    // from the stream. If the last check with the same context found nothing to do, its ETag and
+    // Last-Modified are sent so an unchanged manifest only costs a 304
+    int OpenJson(HTTPClient& http, const char* URL, const String& context)
     {
-			WiFiClientSecure client;
-        HTTPClient http;
-		  client.setInsecure();
+        const char* headers[] = { "ETag", "Last-Modified" };
+
+        http.useHTTP10(true);
         http.begin(URL);
+        http.collectHeaders(headers, 2);
+        if (ManifestCaching)
+        {
+            Preferences prefs;
+            prefs.begin(OTA_PULL_NVS_NAMESPACE, true);
+            if (prefs.getString("context", "") == context)
+            {
+                String etag = prefs.getString("etag", "");
+                String modified = prefs.getString("modified", "");
+                if (!etag.isEmpty())
+                    http.addHeader("If-None-Match", etag);
+                if (!modified.isEmpty())
+                    http.addHeader("If-Modified-Since", modified);
+            }
+            prefs.end();
+        }
 
         // Send HTTP GET request
         int httpResponseCode = http.GET();
+        if (httpResponseCode != 200)
+            http.end();
+        return httpResponseCode;
+    }
 
-        if (httpResponseCode == 200)
+    // Result of the last check, for a 304 response
+    int CachedResult()
+    {
+        Preferences prefs;
+        prefs.begin(OTA_PULL_NVS_NAMESPACE, true);
+        CVersion = prefs.getString("version", "");
+        int result = prefs.getInt("result", NO_UPDATE_AVAILABLE);
+        prefs.end();
+        return result;
+    }
+
+    // Only checks that found nothing to do are cached, anything else fetches the manifest again
+    void SaveManifestCache(HTTPClient& http, const String& context, int result)
+    {
+        if (!ManifestCaching)
+            return;
+        Preferences prefs;
+        prefs.begin(OTA_PULL_NVS_NAMESPACE, false);
+        String etag = http.header("ETag");
+        String modified = http.header("Last-Modified");
+        if ((result == NO_UPDATE_AVAILABLE || result == NO_UPDATE_PROFILE_FOUND) && (!etag.isEmpty() || !modified.isEmpty()))
+        {
+            prefs.putString("context", context);
+            prefs.putString("etag", etag);
+            prefs.putString("modified", modified);
+            prefs.putString("version", CVersion);
+            prefs.putInt("result", result);
+        }
+        else if (prefs.isKey("context"))
+        {
+            prefs.clear();
+        }
+        prefs.end();
+    }
+
+    struct OTABuffer
+    {
+        uint8_t* data;
+        size_t length;
+    };
+
+    // State shared with the flash writer task
+    OTABuffer Buffers[OTA_PULL_BUFFER_COUNT];
+    QueueHandle_t FreeQueue = NULL;
+    QueueHandle_t FullQueue = NULL;
+    SemaphoreHandle_t WriterDone = NULL;
+    volatile size_t Written = 0;
+    volatile bool WriteFailed = false;
+    mbedtls_sha256_context Sha;
+    OTADeltaPatcher Patcher;
+    bool Delta = false;
+    TransferStats Stats = {};
+
+    // Consumer: writes filled buffers to flash and hands them back. A zero length buffer ends the update
+    static void WriterTask(void* parameter)
+    {
+        ESP32OTAPull* ota = (ESP32OTAPull*)parameter;
+        uint8_t index;
+
+        while (xQueueReceive(ota->FullQueue, &index, portMAX_DELAY) == pdTRUE)
+        {
+            OTABuffer* buffer = &ota->Buffers[index];
+            if (buffer->length == 0)
+                break;
+            // written in slices so a flash budget can pause between them
+            for (size_t offset = 0; offset < buffer->length && !ota->WriteFailed; offset += OTA_PULL_FLASH_SLICE)
+            {
+                uint8_t* data = buffer->data + offset;
+                size_t length = min((size_t)OTA_PULL_FLASH_SLICE, buffer->length - offset);
+                uint32_t start = millis();
+                bool ok;
+                if (ota->Delta)
+                    ok = ota->Patcher.Write(data, length);
+                else
+                {
+                    ok = Update.write(data, length) == length;
+                    if (ok)
+                        mbedtls_sha256_update(&ota->Sha, data, length);
+                }
+                ota->Stats.flashMs += millis() - start;
+                if (!ok)
+                {
+                    ota->WriteFailed = true;
+                    break;
+                }
+                ota->Written += length;
+                ota->Pace(ota->Written);
+            }
+            xQueueSend(ota->FreeQueue, &index, portMAX_DELAY);
+        }
+        xSemaphoreGive(ota->WriterDone);
+        vTaskDelete(NULL);
+    }
+
+    // Sleeps until bytes written so far fit in the flash budget
+    void Pace(size_t written)
+    {
+        if (FlashBudget == 0)
+            return;
+        uint32_t due = PaceStart + (uint32_t)((uint64_t)written * 1000 / FlashBudget);
+        int32_t wait = (int32_t)(due - millis());
+        if (wait > 0)
+            vTaskDelay(wait / portTICK_PERIOD_MS);
+    }
+
+    bool AllocatePipeline()
+    {
+        FreeQueue = xQueueCreate(OTA_PULL_BUFFER_COUNT, sizeof(uint8_t));
+        FullQueue = xQueueCreate(OTA_PULL_BUFFER_COUNT, sizeof(uint8_t));
+        WriterDone = xSemaphoreCreateBinary();
+        if (FreeQueue == NULL || FullQueue == NULL || WriterDone == NULL)
+            return false;
+
+        for (uint8_t i = 0; i < OTA_PULL_BUFFER_COUNT; i++)
+        {
+            Buffers[i].data = (uint8_t*)heap_caps_malloc(OTA_PULL_BUFFER_SIZE, MALLOC_CAP_SPIRAM);
+            if (Buffers[i].data == NULL)
+                Buffers[i].data = (uint8_t*)malloc(OTA_PULL_BUFFER_SIZE);
+            if (Buffers[i].data == NULL)
+                return false;
+            xQueueSend(FreeQueue, &i, 0);
+        }
+        return true;
+    }
+
+    void FreePipeline()
+    {
+        for (uint8_t i = 0; i < OTA_PULL_BUFFER_COUNT; i++)
         {
-            payload = http.getString();
+            free(Buffers[i].data);
+            Buffers[i].data = NULL;
         }
+        if (FreeQueue != NULL)
+            vQueueDelete(FreeQueue);
+        if (FullQueue != NULL)
+            vQueueDelete(FullQueue);
+        if (WriterDone != NULL)
+            vSemaphoreDelete(WriterDone);
+        FreeQueue = NULL;
+        FullQueue = NULL;
+        WriterDone = NULL;
+    }
 
-        // Free resources
+    // Reopens the download with a Range request from offset. The server must answer 206 Partial Content
+    bool ResumeDownload(HTTPClient& http, const char* URL, int offset, uint8_t& resumes)
+    {
         http.end();
-        return httpResponseCode;
+        if (resumes >= OTA_PULL_MAX_RESUMES)
+            return false;
+        resumes++;
+        ESP_LOGW("OTA", "Download interrupted at %d bytes, resuming (%d of %d)", offset, resumes, OTA_PULL_MAX_RESUMES);
+        vTaskDelay((1000 * resumes) / portTICK_PERIOD_MS);
+
+        http.begin(URL);
+        http.addHeader("Range", String("bytes=") + offset + "-");
+        int httpResponseCode = http.GET();
+        if (httpResponseCode == 206)
+            return true;
+        ESP_LOGW("OTA", "Resume failed, HTTP %d", httpResponseCode);
+        return false;
+    }
+
+    // Compares the digest of the written image with the hex SHA-256 from the manifest
+    bool VerifyDigest(const char* Sha256)
+    {
+        uint8_t digest[32];
+        char hex[65];
+
+        mbedtls_sha256_finish(&Sha, digest);
+        for (uint8_t i = 0; i < sizeof(digest); i++)
+            sprintf(&hex[i * 2], "%02x", digest[i]);
+        if (Sha256 == NULL || Sha256[0] == 0)
+        {
+            ESP_LOGW("OTA", "No SHA-256 in manifest, image %s not verified", hex);
+            return true;
+        }
+        if (!String(hex).equalsIgnoreCase(Sha256))
+        {
+            ESP_LOGE("OTA", "SHA-256 mismatch, expected %s got %s", Sha256, hex);
+            return false;
+        }
+        return true;
     }
 
-    int DoOTAUpdate(const char* URL, ActionType Action)
+    // Producer: receives into free buffers and queues them for the writer task, so network receive
+    // and flash erase/write overlap. A dropped or stalled connection is resumed from the received offset,
+    // everything before it is already queued in order for the writer. With delta set the download is a
+    // patch against the running image, applied by the writer as it arrives
+    int DoOTAUpdate(const char* URL, ActionType Action, const char* Sha256 = NULL, bool delta = false)
     {
         HTTPClient http;
         http.begin(URL);
@@ -82,46 +425,134 @@ private:
 
             // this is required to start firmware update process
             if (!Update.begin(UPDATE_SIZE_UNKNOWN))
+            {
+                http.end();
                 return OTA_UPDATE_FAIL;
+            }
 
-            // create buffer for read
-            uint8_t buff[1280] = { 0 };
+            Stats = {};
+            Written = 0;
+            WriteFailed = false;
+            memset(Buffers, 0, sizeof(Buffers));
+            mbedtls_sha256_init(&Sha);
+            mbedtls_sha256_starts(&Sha, 0);
+            Delta = delta;
+            PaceStart = millis();
+            if ((Delta && !Patcher.Begin(&Sha)) || !AllocatePipeline() ||
+                xTaskCreatePinnedToCore(WriterTask, "OTA Write", 4096, this, OTA_WRITE_TASK_PRIORITY, NULL, 0) != pdPASS)
+            {
+                FreePipeline();
+                Patcher.Free();
+                mbedtls_sha256_free(&Sha);
+                Update.abort();
+                http.end();
+                return OTA_UPDATE_FAIL;
+            }
 
             // get tcp stream
             WiFiClient* stream = http.getStreamPtr();
 
-            // read all data from server
+            uint32_t startTime = millis();
+            uint32_t lastData = startTime;
+            size_t lastReported = 0;
             int offset = 0;
-            while (http.connected() && offset < totalLength)
+            uint8_t resumes = 0;
+            uint8_t index;
+            while (offset < totalLength && !WriteFailed)
             {
-                size_t sizeAvail = stream->available();
-                if (sizeAvail > 0)
+                if (!http.connected() || millis() - lastData > OTA_PULL_STALL_TIMEOUT)
                 {
-                    size_t bytes_to_read = min(sizeAvail, sizeof(buff));
-                    size_t bytes_read = stream->readBytes(buff, bytes_to_read);
-                    size_t bytes_written = Update.write(buff, bytes_read);
-                    if (bytes_read != bytes_written)
-                    {
-                        // Serial.printf("Unexpected error in OTA: %d %d %d\n", bytes_to_read, bytes_read, bytes_written);
+                    if (!ResumeDownload(http, URL, offset, resumes))
                         break;
+                    stream = http.getStreamPtr();
+                    lastData = millis();
+                }
+                if (xQueueReceive(FreeQueue, &index, portMAX_DELAY) != pdTRUE)
+                    break;
+
+                // fill the buffer, or stop at the end of the image
+                OTABuffer* buffer = &Buffers[index];
+                buffer->length = 0;
+                uint32_t receiveStart = millis();
+                while (http.connected() && buffer->length < OTA_PULL_BUFFER_SIZE &&
+                       offset + (int)buffer->length < totalLength)
+                {
+                    size_t sizeAvail = stream->available();
+                    if (sizeAvail == 0)
+                    {
+                        if (millis() - lastData > OTA_PULL_STALL_TIMEOUT)
+                            break;
+                        vTaskDelay(1 / portTICK_PERIOD_MS);
+                        continue;
                     }
-                    offset += bytes_written;
-                    if (Callback != NULL)
-                        Callback(offset, totalLength);
+                    size_t bytes_to_read = min(sizeAvail, (size_t)(OTA_PULL_BUFFER_SIZE - buffer->length));
+                    bytes_to_read = min(bytes_to_read, (size_t)(totalLength - offset - buffer->length));
+                    buffer->length += stream->readBytes(buffer->data + buffer->length, bytes_to_read);
+                    lastData = millis();
+                }
+                Stats.networkMs += millis() - receiveStart;
+
+                // nothing received, reconnect at the top of the loop
+                if (buffer->length == 0)
+                {
+                    xQueueSend(FreeQueue, &index, 0);
+                    continue;
+                }
+                resumes = 0;
+                offset += buffer->length;
+                xQueueSend(FullQueue, &index, portMAX_DELAY);
+
+                if (Callback != NULL && Written != lastReported)
+                {
+                    lastReported = Written;
+                    Callback(lastReported, totalLength);
                 }
             }
 
-            if (offset == totalLength)
+            // an empty buffer tells the writer to finish
+            xQueueReceive(FreeQueue, &index, portMAX_DELAY);
+            Buffers[index].length = 0;
+            xQueueSend(FullQueue, &index, portMAX_DELAY);
+            xSemaphoreTake(WriterDone, portMAX_DELAY);
+            FreePipeline();
+            http.end();
+
+            // without a digest in the manifest a patch is checked against the one in its header
+            char patchDigest[65] = "";
+            if (Delta)
+            {
+                if (!WriteFailed && !Patcher.End())
+                    WriteFailed = true;
+                if (WriteFailed && Patcher.GetError() != NULL)
+                    ESP_LOGE("OTA", "Delta update failed: %s", Patcher.GetError());
+                Patcher.GetNewDigest(patchDigest);
+                Patcher.Free();
+                if (Sha256 == NULL || Sha256[0] == 0)
+                    Sha256 = patchDigest;
+            }
+            bool verified = !WriteFailed && (int)Written == totalLength && VerifyDigest(Sha256);
+            mbedtls_sha256_free(&Sha);
+
+            Stats.bytes = Written;
+            Stats.elapsedMs = millis() - startTime;
+            Stats.bytesPerSecond = Stats.elapsedMs > 0 ? (uint32_t)((uint64_t)Stats.bytes * 1000 / Stats.elapsedMs) : 0;
+            ESP_LOGI("OTA", "%u bytes in %u ms (%u bytes/s), network %u ms, flash %u ms", (unsigned)Stats.bytes,
+                     (unsigned)Stats.elapsedMs, (unsigned)Stats.bytesPerSecond, (unsigned)Stats.networkMs, (unsigned)Stats.flashMs);
+            if (Callback != NULL)
+                Callback(Written, totalLength);
+
+            if (verified)
             {
                 Update.end(true);
-                delay(1000);
 
                 // Restart ESP32 to see changes
                 if (Action == UPDATE_BUT_NO_BOOT)
                     return UPDATE_OK;
+                delay(1000);
                 ESP.restart();
             }
-            return WRITE_ERROR;
+            Update.abort();
+            return (!WriteFailed && (int)Written == totalLength) ? VERIFY_FAILED : WRITE_ERROR;
         }
 
         http.end();
@@ -129,6 +560,25 @@ private:
     }
 
 public:
+    /// @brief Skip whitespace in a JSON stream and return the next character without consuming it
+    /// @param stream The stream being parsed, its timeout applies while waiting for data
+    /// @return The character, or -1 on timeout
+    static int PeekJson(Stream& stream)
+    {
+        uint32_t start = millis();
+        while (millis() - start < stream.getTimeout())
+        {
+            int c = stream.peek();
+            if (c < 0)
+                delay(1);
+            else if (isspace(c))
+                stream.read();
+            else
+                return c;
+        }
+        return -1;
+    }
+
     /// @brief Return the version string of the binary, as reported by the JSON
     /// @return The firmware version
     String GetVersion()
@@ -136,6 +586,13 @@ public:
         return CVersion;
     }
 
+    /// @brief Return the transfer statistics of the last update
+    /// @return Bytes written, time spent receiving and writing to flash, and throughput
+    TransferStats GetStats()
+    {
+        return Stats;
+    }
+
     /// @brief Override the default "Device" id (MAC Address)
     /// @param device A string identifying the particular device (instance) (typically e.g., a MAC address)
     /// @return The current ESP32OTAPull object for chaining
@@ -172,6 +629,33 @@ public:
         return *this;
     }
 
+    /// @brief Specify whether a delta image from the manifest may be used instead of the full image
+    /// @param allow_delta true if delta updates are allowed
+    /// @return The current ESP32OTAPull object for chaining
+    ESP32OTAPull &AllowDelta(bool allow_delta)
+    {
+        DeltaAllowed = allow_delta;
+        return *this;
+    }
+
+    /// @brief Specify whether the manifest ETag/Last-Modified are kept in NVS for conditional requests
+    /// @param cache true to skip the download and parse of an unchanged manifest
+    /// @return The current ESP32OTAPull object for chaining
+    ESP32OTAPull &CacheManifest(bool cache)
+    {
+        ManifestCaching = cache;
+        return *this;
+    }
+
+    /// @brief Limit how fast the image is written to flash, so other tasks keep getting flash access
+    /// @param bytes_per_second Write rate limit, 0 for none
+    /// @return The current ESP32OTAPull object for chaining
+    ESP32OTAPull &SetFlashBudget(uint32_t bytes_per_second)
+    {
+        FlashBudget = bytes_per_second;
+        return *this;
+    }
+
     /// @brief Specify a callback function to monitor update progress
     /// @param callback Pointer to a function that is called repeatedly during update
     /// @return The current ESP32OTAPull object for chaining
@@ -190,40 +674,84 @@ public:
     {
         CurrentVersion = CurrentVersion == NULL ? "" : CurrentVersion;
 
+        String DeviceName = Device.isEmpty() ? WiFi.macAddress() : Device;
+        const char* BoardName = Board.isEmpty() ? ARDUINO_BOARD : Board.c_str();
+
+        // A cached result is only valid for the same manifest and matching inputs
+        String context = String(JSON_URL) + '|' + CurrentVersion + '|' + BoardName + '|' + DeviceName + '|' +
+                         Config + '|' + (DowngradesAllowed ? '1' : '0');
+
         // Downloading OTA Json...
-        String Payload;
-        int httpResponseCode = DownloadJson(JSON_URL, Payload);
+        HTTPClient http;
+        int httpResponseCode = OpenJson(http, JSON_URL, context);
+        if (httpResponseCode == 304)
+            return CachedResult();
         if (httpResponseCode != 200)
             return httpResponseCode > 0 ? httpResponseCode : HTTP_FAILED;
 
-        // Deserialize the JSON file downloaded from user's site
-        JsonDocument doc;
-        DeserializationError deserialization = deserializeJson(doc, Payload.c_str());
-        if (deserialization != DeserializationError::Ok)
+        // Only these fields of a configuration are kept
+        JsonDocument filter;
+        for (const char* field : { "Board", "Device", "Version", "Config", "URL", "SHA256", "DeltaURL", "DeltaFrom" })
+            filter[field] = true;
+
+        // The configurations are read from the stream one at a time, so the manifest size does not matter
+        Stream& stream = http.getStream();
+        if (!stream.find("\"Configurations\"") || !stream.find("["))
+        {
+            http.end();
             return JSON_PROBLEM;
+        }
+        if (PeekJson(stream) == ']')
+        {
+            SaveManifestCache(http, context, NO_UPDATE_PROFILE_FOUND);
+            http.end();
+            return NO_UPDATE_PROFILE_FOUND;
+        }
 
-        String DeviceName = Device.isEmpty() ? WiFi.macAddress() : Device;
-        String BoardName = Board.isEmpty() ? ARDUINO_BOARD : Board;
-        String ConfigName = Config.isEmpty() ? "" : Config;
+        JsonDocument config;
         bool foundProfile = false;
-
-        // Step through the configurations looking for a match
-        for (auto config : doc["Configurations"].as<JsonArray>())
+        do
         {
-            String CBoard = config["Board"].isNull() ? "" : (const char *)config["Board"];
-            String CDevice = config["Device"].isNull() ? "" : (const char *)config["Device"];
-            CVersion = config["Version"].isNull() ? "" : (const char *)config["Version"];
-            String CConfig = config["Config"].isNull() ? "" : (const char *)config["Config"];
-            if ((CBoard.isEmpty() || CBoard == BoardName) &&
-                (CDevice.isEmpty() || CDevice == DeviceName) &&
-                (CConfig.isEmpty() || CConfig == ConfigName))
+            if (deserializeJson(config, stream, DeserializationOption::Filter(filter)) != DeserializationError::Ok)
             {
-                if (CVersion.isEmpty() || CVersion > String(CurrentVersion) ||
-                    (DowngradesAllowed && CVersion != String(CurrentVersion)))
-                    return Action == DONT_DO_UPDATE ? UPDATE_AVAILABLE : DoOTAUpdate(config["URL"], Action);
+                http.end();
+                return JSON_PROBLEM;
+            }
+            const char* CBoard = config["Board"] | "";
+            const char* CDevice = config["Device"] | "";
+            const char* CConfig = config["Config"] | "";
+            const char* Version = config["Version"] | "";
+            if ((CBoard[0] == 0 || strcmp(CBoard, BoardName) == 0) &&
+                (CDevice[0] == 0 || DeviceName == CDevice) &&
+                (CConfig[0] == 0 || Config == CConfig))
+            {
+                CVersion = Version;
+                if (Version[0] == 0 || OTAVersion::Compare(Version, CurrentVersion) > 0 ||
+                    (DowngradesAllowed && OTAVersion::Compare(Version, CurrentVersion) != 0))
+                {
+                    SaveManifestCache(http, context, UPDATE_AVAILABLE);
+                    http.end();
+                    if (Action == DONT_DO_UPDATE)
+                        return UPDATE_AVAILABLE;
+
+                    // a delta is only usable when it was made from the running version
+                    const char* CDeltaFrom = config["DeltaFrom"] | "";
+                    if (DeltaAllowed && !config["DeltaURL"].isNull() && strcmp(CDeltaFrom, CurrentVersion) == 0)
+                    {
+                        int result = DoOTAUpdate(config["DeltaURL"], Action, config["SHA256"], true);
+                        if (result == UPDATE_OK)
+                            return result;
+                        ESP_LOGW("OTA", "Delta update failed (%d), downloading the full image", result);
+                    }
+                    return DoOTAUpdate(config["URL"], Action, config["SHA256"]);
+                }
                 foundProfile = true;
             }
-        }
-        return foundProfile ? NO_UPDATE_AVAILABLE : NO_UPDATE_PROFILE_FOUND;
+        } while (stream.findUntil(",", "]"));
+
+        int result = foundProfile ? NO_UPDATE_AVAILABLE : NO_UPDATE_PROFILE_FOUND;
+        SaveManifestCache(http, context, result);
+        http.end();
+        return result;
     }
 };
\ No newline at end of file
@@ -6,6 +6,8 @@
 #include <WiFiClientSecure.h>
 #include <ArduinoJson.h>
 #include "ota_pull.h"
+#include "esp32_manager.h"
+#include "esp32_manager_task_priorities.h"
 
 #include <time.h>
 
@@ -14,10 +16,22 @@ static const char *url = "https://github.com/Pirate-MIDI/Spin/raw/refs/heads/mai
 void onOTAStart();
 void onOTAProgress(size_t current, size_t final);
 void onOTAEnd(bool success);
+void ota_StartUpdate();
+void ota_FinishUpdate(bool success);
+void ota_PullProgress(int offset, int totalLength);
 
 AsyncWebServer server(80);
 unsigned long ota_progress_millis = 0;
 
+static OtaRebootPolicy rebootPolicy = OtaRebootImmediate;
+static uint32_t flashBudget = OTA_FLASH_BUDGET;
+static uint32_t otaStartTime = 0;
+static uint8_t otaActive = 0;
+static uint8_t wirelessMidiBlocked = 0;		// blockWirelessMidi before the update started
+static volatile uint8_t rebootPending = 0;
+static volatile uint8_t rebootRequested = 0;
+static uint32_t rebootTime = 0;
+
 void ota_Begin()
 {
 	if(WiFi.status() != WL_CONNECTED)
@@ -30,6 +44,7 @@ void ota_Begin()
 	});
 
 	ElegantOTA.begin(&server);    // Start ElegantOTA
+	ElegantOTA.setAutoReboot(false);	// rebooted from ota_Process
 	// ElegantOTA callbacks
 	ElegantOTA.onStart(onOTAStart);
 	ElegantOTA.onProgress(onOTAProgress);
@@ -42,56 +57,141 @@ void ota_Begin()
 void ota_Process()
 {
 	ElegantOTA.loop();
+
+	// Restart once the host allows it, leaving time for the upload response to be sent
+	if(rebootPending && (rebootPolicy == OtaRebootImmediate || rebootRequested) &&
+		(int32_t)(millis() - rebootTime) >= 0)
+	{
+		ESP_LOGI("OTA", "Rebooting into the new firmware");
+		ESP.restart();
+	}
+}
+
+void ota_SetRebootPolicy(OtaRebootPolicy policy)
+{
+	rebootPolicy = policy;
+}
+
+void ota_SetFlashBudget(uint32_t bytesPerSecond)
+{
+	flashBudget = bytesPerSecond;
 }
 
+uint8_t ota_InProgress()
+{
+	return otaActive;
+}
+
+uint8_t ota_RebootPending()
+{
+	return rebootPending;
+}
+
+// Called by the host at a safe point, e.g. after the current song
+void ota_RequestReboot()
+{
+	rebootRequested = 1;
+}
+
+// Checks the manifest and installs any update without rebooting. The calling task drops below the
+// MIDI task for the duration and the flash writes are paced by the flash budget
+int ota_PullUpdate(const char* manifestUrl, const char* currentVersion)
+{
+	ESP32OTAPull otaPull;
+	UBaseType_t priority = uxTaskPriorityGet(NULL);
+
+	vTaskPrioritySet(NULL, OTA_PULL_TASK_PRIORITY);
+	ota_StartUpdate();
+	otaPull.SetFlashBudget(flashBudget).SetCallback(ota_PullProgress);
+	int result = otaPull.CheckForOTAUpdate(manifestUrl, currentVersion, ESP32OTAPull::UPDATE_BUT_NO_BOOT);
+	ota_FinishUpdate(result == ESP32OTAPull::UPDATE_OK);
+	vTaskPrioritySet(NULL, priority);
+	return result;
+}
+
+// Returns the version of the first configuration in the manifest. Only that entry is parsed,
+// straight from the HTTP stream
 String ota_GetLatestVersion(String url)
 {
 	JsonDocument doc;
-	WiFiClientSecure client;
+	JsonDocument filter;
 	HTTPClient http;
-	String response;
-	//client.setInsecure();
-	
+	String version;
+
+	http.useHTTP10(true);
 	http.begin(url);  // Specify the URL
 	int httpCode = http.GET();  // Send the GET request
 
-	if (httpCode > 0)
+	if (httpCode <= 0)
 	{
-		// Check for successful response
-		if (httpCode == HTTP_CODE_OK)
-		{
-			// Get the response payload (JSON data)
-			response = http.getString();  
-			// Print the raw JSON data
-			ESP_LOGD("OTA", "Received JSON:");
-			//Serial.println(response);
-		}
-		else
-			return "HTTP GET request failed";
-
-	}
-	else
+		http.end();
 		return "Failed to connect to GitHub";
+	}
+	if (httpCode != HTTP_CODE_OK)
+	{
+		http.end();
+		return "HTTP GET request failed";
+	}
 
+	Stream& stream = http.getStream();
+	if (!stream.find("\"Configurations\"") || !stream.find("["))
+	{
+		http.end();
+		return "Configurations not found";
+	}
+	// an empty list has no latest version
+	if (ESP32OTAPull::PeekJson(stream) == ']')
+	{
+		http.end();
+		return "";
+	}
+	filter["Version"] = true;
+	DeserializationError error = deserializeJson(doc, stream, DeserializationOption::Filter(filter));
 	http.end();  // Close the connection
-	DeserializationError error = deserializeJson(doc, response);
 	if (error)
 		return error.c_str();
-	
+
+	ESP_LOGD("OTA", "Received JSON:");
 	//serializeJsonPretty(doc, Serial);
 
-	const char* version = doc["Configurations"][0]["Version"];
-	
-	return (String)version;
+	version = doc["Version"] | "";
+	return version;
+}
+
+// Wireless MIDI is paused while an update runs, wired MIDI keeps routing
+void ota_StartUpdate()
+{
+	otaActive = 1;
+	otaStartTime = millis();
+	wirelessMidiBlocked = blockWirelessMidi;
+	blockWirelessMidi = 1;
+}
+
+void ota_FinishUpdate(bool success)
+{
+	blockWirelessMidi = wirelessMidiBlocked;
+	otaActive = 0;
+	if(success)
+	{
+		rebootTime = millis() + OTA_REBOOT_DELAY;
+		rebootPending = 1;
+		ESP_LOGI("OTA", "Update installed, %s", rebootPolicy == OtaRebootImmediate ? "rebooting" : "waiting for reboot request");
+	}
+}
+
+void ota_PullProgress(int offset, int totalLength)
+{
+	onOTAProgress(offset, totalLength);
 }
 
 void onOTAStart()
 {
   // Log when OTA has started
   Serial.println("OTA update started!");
-  // <Add your own code here>
+  ota_StartUpdate();
 }
 
+// ElegantOTA writes from the async TCP task, so holding it here throttles the upload to the flash budget
 void onOTAProgress(size_t current, size_t final)
 {
   // Log every 1 second
@@ -99,6 +199,11 @@ void onOTAProgress(size_t current, size_t final)
     ota_progress_millis = millis();
     ESP_LOGI("OTA", "OTA Progress Current: %u bytes, Final: %u bytes\n", current, final);
   }
+  if (otaActive && flashBudget > 0) {
+    int32_t wait = (int32_t)(otaStartTime + (uint32_t)((uint64_t)current * 1000 / flashBudget) - millis());
+    if (wait > 0)
+      vTaskDelay(min(wait, (int32_t)OTA_MAX_PACE_DELAY) / portTICK_PERIOD_MS);
+  }
 }
 
 void onOTAEnd(bool success)
@@ -109,7 +214,7 @@ void onOTAEnd(bool success)
   } else {
     Serial.println("There was an error during OTA update!");
   }
-  // <Add your own code here>
+  ota_FinishUpdate(success);
 }
 
 void setClock()
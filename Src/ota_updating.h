@@ -3,9 +3,29 @@
 
 #include "Arduino.h"
 
+// Flash write rate limit during updates in bytes/s, 0 for none
+#ifndef OTA_FLASH_BUDGET
+#define OTA_FLASH_BUDGET		(128 * 1024)
+#endif
+#define OTA_REBOOT_DELAY		1000		// ms between a finished update and the reboot
+#define OTA_MAX_PACE_DELAY		50			// ms the upload is held per progress callback
+
+typedef enum
+{
+	OtaRebootImmediate,
+	OtaRebootDeferred			// wait for ota_RequestReboot(), e.g. after the current song
+} OtaRebootPolicy;
+
 void ota_Begin();
 void ota_Process();
 
+void ota_SetRebootPolicy(OtaRebootPolicy policy);
+void ota_SetFlashBudget(uint32_t bytesPerSecond);
+uint8_t ota_InProgress();
+uint8_t ota_RebootPending();
+void ota_RequestReboot();
+int ota_PullUpdate(const char* manifestUrl, const char* currentVersion);
+
 String ota_GetLatestVersion(String url);
 
 #endif /* OTA_UPDATING_H_ */
\ No newline at end of file
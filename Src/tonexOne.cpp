@@ -4,22 +4,50 @@
 #include "esp_log.h"
 #include "tonexOne_Parameters.h"
 #include "usb_host.h"
+#include "crc16.h"
+#include "tonexOne_Interface.h"
+#include "freertos/semphr.h"
 
 static const char *TAG = "tonexOne";
 
 #define FRAMING_BYTE 0x7E
+#define FRAMING_ESCAPE_BYTE 0x7D
+#define FRAMING_ESCAPE_XOR 0x20
 
 // Data buffer definitions
 #define RX_TEMP_BUFFER_SIZE                         8192
-#define MAX_INPUT_BUFFERS                           2
 #define USB_TX_BUFFER_SIZE                          8192 
 
 #define MAX_SHORT_PRESET_DATA                       3072
-#define MAX_FULL_PRESET_DATA                        RX_TEMP_BUFFER_SIZE
+#define MAX_FULL_PRESET_DATA                        32768
 #define MAX_STATE_DATA                              512
 
 #define TONEX_ONE_RESP_OFFSET_PRESET_NAME_LEN 32
 
+// B9 03 followed by up to three 3-byte values (type, size, unknown)
+#define TONEX_HEADER_MAX_LENGTH                 11
+#define TONEX_TYPE_PRESET_DETAILS_FULL          0x0303
+// BA 03 BA 6D, as seen through a rolling 4 byte window
+#define PRESET_PARAM_START_MARKER               0xBA03BA6D
+#define PRESET_PARAM_VALUE_MARKER               0x88
+#define FULL_PRESET_PROGRESS_STEP               1024
+
+// Preset cache prefetch timing (ms)
+#define PRESET_CACHE_NONE                       0xFF
+#define PRESET_CACHE_REQUEST_INTERVAL_MS        50
+#define PRESET_CACHE_REQUEST_TIMEOUT_MS         1000
+#define PRESET_CACHE_HOLDOFF_MS                 1000
+#define PRESET_CACHE_MUTEX_TIMEOUT_MS           100
+
+// Parameter writes sent per tonexOne_Process call
+#define TONEX_ONE_COMMAND_BATCH                 8
+
+// Global edits are collected for this long after the last change before the state is sent,
+// but never held for longer than the max latency (ms)
+#define STATE_DEBOUNCE_MS                       30
+#define STATE_MAX_LATENCY_MS                    100
+// USB writes are kept below the 64 byte max packet size
+
 #define TONEX_STATE_OFFSET_START_INPUT_TRIM     15          // 0x000070c1 (-15.0) -> 0x000058c1 (0) -> 0x00007041 (15.0) 
 #define TONEX_STATE_OFFSET_START_STOMP_MODE     19          // 0x00 - off, 0x01 - on
 #define TONEX_STATE_OFFSET_START_CAB_BYPASS     20          // 0x00 - off, 0x01 - on
@@ -97,10 +125,21 @@ typedef struct
 	PedalData pedalData;
 } TonexMessage;
 
+// Range of stateData changed locally and not yet sent to the pedal
+typedef struct
+{
+	uint16_t start;
+	uint16_t end;
+	uint32_t firstChangeTime;
+	uint32_t lastChangeTime;
+	uint8_t dirty;
+} StateDelta;
+
 typedef struct
 {
 	TonexMessage message;
 	uint8_t tonexState;
+	StateDelta stateDelta;
 } TonexData;
 
 typedef struct
@@ -109,13 +148,88 @@ typedef struct
 	uint32_t payload;
 } USBMessage;
 
+typedef enum
+{
+	RxFramingHunt,			// Waiting for an opening flag
+	RxFramingData,			// Collecting de-framed bytes
+	RxFramingEscape,		// Last byte was an escape, the next byte is XORed
+	RxFramingDiscard		// Frame overflowed or was malformed, waiting for the next flag
+} RxFramingState;
+
+// Streaming de-framer state. Bytes are unstuffed and checked as they arrive,
+// so a frame is complete as soon as its closing flag is received
+typedef struct
+{
+	RxFramingState state;
+	uint8_t* data;
+	uint16_t length;
+	uint16_t capacity;
+	uint16_t crc;
+	uint8_t* buffer;		// default sink, data is redirected elsewhere for large frames
+} RxFramer;
+
+// One piece of an outgoing message. A message is framed from several of these without
+// first being copied together
+typedef struct
+{
+	const uint8_t* data;
+	uint16_t length;
+} TonexTxSegment;
+
+typedef enum
+{
+	ParamParserMarker,		// Looking for the parameter block start marker
+	ParamParserPrefix,		// Expecting the 0x88 value marker
+	ParamParserValue,		// Collecting the 4 byte float
+	ParamParserDone
+} ParamParserState;
+
+// Incremental parameter parser, fed one de-framed byte at a time
+typedef struct
+{
+	ParamParserState state;
+	uint32_t window;
+	uint16_t paramIndex;
+	uint8_t valueBytes;
+	uint8_t value[sizeof(float)];
+	float values[TONEX_PARAM_LAST];
+} PresetParamParser;
+
+// Full preset details (~30 KB) are de-framed straight into this PSRAM store
+typedef struct
+{
+	uint8_t* data;
+	uint16_t length;			// length of the last completed download, including the header
+	uint16_t headerLength;
+	uint16_t total;				// payload size announced in the header
+	uint16_t progressMark;
+	uint8_t requestedPreset;
+	uint8_t preset;
+	uint8_t active;				// the RX framer is currently writing into the store
+	uint8_t valid;
+	char name[TONEX_ONE_RESP_OFFSET_PRESET_NAME_LEN + 1];
+	PresetParamParser parser;
+} FullPresetStore;
+
+typedef struct
+{
+	char name[TONEX_ONE_RESP_OFFSET_PRESET_NAME_LEN + 1];
+	float parameters[TONEX_PARAM_LAST];
+	uint8_t valid;
+} PresetCacheEntry;
+
+// Names and parameters of every preset on the pedal, filled in the background
 typedef struct
 {
-    uint8_t data[RX_TEMP_BUFFER_SIZE];
-    uint16_t length;
-    uint8_t readyToRead : 1;
-    uint8_t readyToWrite : 1;
-} InputBufferEntry;
+	PresetCacheEntry* entries;
+	SemaphoreHandle_t mutex;
+	uint8_t pendingPreset;		// preset with an outstanding prefetch request
+	uint8_t editedPreset;		// active preset with live edits, its entry is refetched once it is left
+	uint8_t nextPreset;
+	uint32_t requestTime;
+	uint32_t holdoffTime;		// last user initiated request, prefetching backs off after it
+	PresetParamParser parser;
+} PresetCache;
 
 
 // Private Function Prototypes
@@ -123,35 +237,68 @@ esp_err_t tonexOne_RequestState(void);
 esp_err_t tonexOne_SetActiveSlot(Slot newSlot);
 uint16_t tonexOne_GetCurrentActivePreset(void);
 esp_err_t tonexOne_SetPresetInSlot(uint16_t preset, Slot newSlot, uint8_t selectSlot);
+esp_err_t tonexOne_SendState(void);
+void tonexOne_StateWrite(uint16_t offset, const void* data, uint16_t length);
+void tonexOne_StateDeltaProcess(void);
 
-ParsingStatus tonexOne_ParsePacket(uint8_t *message, uint16_t inlength);
+ParsingStatus tonexOne_ParsePacket(uint8_t *message, uint16_t length);
 uint16_t tonexOne_ParseValue(uint8_t *message, uint8_t *index);
 ParsingStatus tonexOne_ParseState(uint8_t *unframed, uint16_t length, uint16_t index);
 
-uint16_t tonexOne_CalculateCRC(uint8_t *data, uint16_t length);
-uint16_t tonexOne_AddByteWithStuffing(uint8_t *output, uint8_t byte);
-uint16_t tonexOne_AddFraming(uint8_t *input, uint16_t inlength, uint8_t *output);
-ParsingStatus tonexOne_RemoveFraming(uint8_t *input, uint16_t inlength, uint8_t *output, uint16_t *outlength);
+uint16_t tonexOne_PutByteWithStuffing(uint8_t byte);
+esp_err_t tonexOne_TransmitFramed(const TonexTxSegment* segments, uint8_t count, uint8_t padToPacket);
+uint8_t tonexOne_RxByte(uint8_t byte);
+void tonexOne_RxResetFrame(RxFramingState state);
+
+uint8_t tonexOne_CdcInit(uint8_t slot);
+void tonexOne_CdcDeinit(uint8_t slot);
+void tonexOne_CdcRx(uint8_t slot, uint8_t* data, uint16_t length);
+void tonexOne_CdcTick(uint8_t slot);
+void tonexOne_RxCheckFullPreset(void);
+void tonexOne_FullPresetByte(uint8_t byte);
+void tonexOne_ParamParserByte(PresetParamParser* parser, uint8_t byte);
 
 esp_err_t tonexOne_ProcessSingleMessage(uint8_t* data, uint16_t length);
+uint8_t tonexOne_ProcessPending(void);
 esp_err_t tonexOne_RequestPresetDetails(uint8_t preset_index, uint8_t full_details);
-uint16_t tonexOne_LocateMessageEnd(uint8_t* data, uint16_t length);
 void tonexOne_ParsePresetParameters(uint8_t* raw_data, uint16_t length);
 ParsingStatus tonexOne_ParsePresetDetails(uint8_t* unframed, uint16_t length, uint16_t index);
+ParsingStatus tonexOne_ParsePresetDetailsFull(uint8_t* unframed, uint16_t length, uint16_t index);
+void tonexOne_ApplyFullPresetParameters(void);
+void tonexOne_ExtractPresetName(uint8_t* data, uint16_t length, char* name);
+
+void tonexOne_PresetCacheHoldoff(void);
+uint8_t tonexOne_PresetCacheReplyPreset(void);
+void tonexOne_PresetCachePrefetch(void);
+void tonexOne_PresetCacheStore(uint8_t preset, uint8_t* data, uint16_t length);
+void tonexOne_PresetCacheInvalidate(uint8_t preset);
 
 esp_err_t tonexOne_ModifyParameter(uint16_t index, float value);
 esp_err_t tonexOne_ModifyGlobal(uint16_t global_val, float value);
 esp_err_t tonexOne_SendSingleParameter(uint16_t index, float value);
 
-//uint8_t framedBuffer[MAX_RAW_DATA];
-//uint8_t txBuffer[MAX_RAW_DATA];
 //uint8_t tonexOneRawRxData[RX_BUFFER_SIZE];
-static volatile InputBufferEntry* inputBuffers;
+static RxFramer rxFramer;
+static FullPresetStore fullPreset;
+static PresetCache presetCache;
+static void (*fullPresetProgressCallback)(uint16_t received, uint16_t total);
 static TonexData* tonexData;
+static uint8_t tonexOneCdcSlot = CDC_SLOT_NONE;
+
+static const CdcDriver tonexOneCdcDriver = {
+	"Tonex One",
+	TONEX_ONE_VID,
+	TONEX_ONE_PID,
+	CDC_MATCH_ANY,
+	115200,
+	64,						// one bulk IN packet per read
+	4096,						// room for a few padded state writes
+	tonexOne_CdcInit,
+	tonexOne_CdcDeinit,
+	tonexOne_CdcRx,
+	tonexOne_CdcTick
+};
 static char preset_name[TONEX_ONE_RESP_OFFSET_PRESET_NAME_LEN + 1];
-static uint8_t* txBuffer;
-static uint8_t* framedBuffer;
-static QueueHandle_t input_queue;
 
 uint8_t bootInitNeeded = 1;
 char presetName[TONEX_ONE_RESP_OFFSET_PRESET_NAME_LEN + 1];
@@ -164,6 +311,7 @@ static const uint8_t presetByteMarker[] = {0xB9, 0x04, 0xB9, 0x02, 0xBC, 0x21};
 
 uint32_t presetChangeSentTime = 0;
 uint8_t presetChangeSent = 0;
+uint16_t presetChangeTarget = 0;	// slot C preset last sent, relative changes count from it until the state arrives
 uint8_t stateDataReceived = 0;
 
 
@@ -172,64 +320,167 @@ void tonexOne_Init()
 {
 	// Initialise the paramter protection mutex
 	tonexOne_Parameters_Init();
-	// allocate RX buffers in PSRAM
-	inputBuffers = (InputBufferEntry*)heap_caps_malloc(sizeof(InputBufferEntry) * MAX_INPUT_BUFFERS, MALLOC_CAP_SPIRAM);
-	if (inputBuffers == NULL)
+	// buffers are kept across reconnects, so they are only allocated the first time
+	// allocate the de-framed RX buffer in internal RAM, as it is written one byte at a time
+	if (rxFramer.buffer == NULL)
 	{
-		 ESP_LOGE(TAG, "Failed to allocate input buffers!");
+		rxFramer.buffer = (uint8_t*)heap_caps_malloc(RX_TEMP_BUFFER_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	}
+	if (rxFramer.buffer == NULL)
+	{
+		 ESP_LOGE(TAG, "Failed to allocate RX frame buffer!");
 		 return;
 	}
+	tonexOne_RxResetFrame(RxFramingHunt);
 
-	// set all buffers as ready for writing
-	for (uint8_t loop = 0; loop < MAX_INPUT_BUFFERS; loop++)
+	// full preset downloads are too big for the RX buffer, so they get their own store
+	if (fullPreset.data == NULL)
 	{
-		 memset((void*)inputBuffers[loop].data, 0, RX_TEMP_BUFFER_SIZE);
-		 inputBuffers[loop].readyToWrite = 1;
-		 inputBuffers[loop].readyToRead = 0;
-		 inputBuffers[loop].length = 0;
+		fullPreset.data = (uint8_t*)heap_caps_malloc(MAX_FULL_PRESET_DATA, MALLOC_CAP_SPIRAM);
 	}
-
-	// more big buffers in PSRAM
-	txBuffer = (uint8_t*)heap_caps_malloc(RX_TEMP_BUFFER_SIZE, MALLOC_CAP_SPIRAM);
-	if (txBuffer == NULL)
+	if (fullPreset.data == NULL)
 	{
-		 ESP_LOGE(TAG, "Failed to allocate txBuffer buffer!");
+		 ESP_LOGE(TAG, "Failed to allocate full preset buffer!");
 		 return;
 	}
-	
-	framedBuffer = (uint8_t*)heap_caps_malloc(RX_TEMP_BUFFER_SIZE, MALLOC_CAP_SPIRAM);
-	if (framedBuffer == NULL)
+	fullPreset.requestedPreset = 0xFF;
+
+	if (presetCache.entries == NULL)
+	{
+		presetCache.entries = (PresetCacheEntry*)heap_caps_malloc(sizeof(PresetCacheEntry) * MAX_TONEX_ONE_PRESETS, MALLOC_CAP_SPIRAM);
+	}
+	if (presetCache.mutex == NULL)
+	{
+		presetCache.mutex = xSemaphoreCreateMutex();
+	}
+	if (presetCache.entries == NULL || presetCache.mutex == NULL)
 	{
-		 ESP_LOGE(TAG, "Failed to allocate framedBuffer buffer!");
+		 ESP_LOGE(TAG, "Failed to allocate preset cache!");
 		 return;
 	}
+	memset((void*)presetCache.entries, 0, sizeof(PresetCacheEntry) * MAX_TONEX_ONE_PRESETS);
+	presetCache.pendingPreset = PRESET_CACHE_NONE;
+	presetCache.editedPreset = PRESET_CACHE_NONE;
 
-	tonexData = (TonexData*)heap_caps_malloc(sizeof(TonexData), MALLOC_CAP_SPIRAM);
+	if (tonexData == NULL)
+	{
+		tonexData = (TonexData*)heap_caps_malloc(sizeof(TonexData), MALLOC_CAP_SPIRAM);
+	}
 	if (tonexData == NULL)
 	{
 		 ESP_LOGE(TAG, "Failed to allocate TonexData buffer!");
 		 return;
 	}
 
-	memset((void*)tonexData, 0, sizeof(tonexData));
+	memset((void*)tonexData, 0, sizeof(TonexData));
 	tonexData->tonexState = CommsStateIdle;
 	ESP_LOGE(TAG, "Tonex One buffers allocated in PSRAM: %d", heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
 }
 
-void tonexOne_InitQueue(QueueHandle_t comms_queue)
+void tonexOne_AssignFullPresetProgressCallback(void (*callback)(uint16_t received, uint16_t total))
+{
+	fullPresetProgressCallback = callback;
+}
+
+void tonexOne_RegisterCdcDriver()
+{
+	cdc_RegisterDriver(&tonexOneCdcDriver);
+}
+
+esp_err_t tonexOne_RequestFullPreset(uint8_t preset)
+{
+	if(!cdc_IsActive(tonexOneCdcSlot))
+	{
+		ESP_LOGE(TAG, "No Tonex One device mounted.");
+		return ESP_FAIL;
+	}
+	if (fullPreset.data == NULL || fullPreset.active)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+	fullPreset.requestedPreset = preset;
+	tonexOne_PresetCacheHoldoff();
+	return tonexOne_RequestPresetDetails(preset, 1);
+}
+
+// Copies a cached preset name. Returns 0 if the preset has not been fetched yet
+uint8_t tonexOne_GetCachedPresetName(uint8_t preset, char* name, uint8_t maxLength)
+{
+	uint8_t result = 0;
+
+	if (preset >= MAX_TONEX_ONE_PRESETS || presetCache.entries == NULL || name == NULL || maxLength == 0)
+	{
+		return 0;
+	}
+	if (xSemaphoreTake(presetCache.mutex, pdMS_TO_TICKS(PRESET_CACHE_MUTEX_TIMEOUT_MS)) == pdTRUE)
+	{
+		if (presetCache.entries[preset].valid)
+		{
+			strncpy(name, presetCache.entries[preset].name, maxLength - 1);
+			name[maxLength - 1] = 0;
+			result = 1;
+		}
+		xSemaphoreGive(presetCache.mutex);
+	}
+	return result;
+}
+
+// Copies up to count cached parameter values. Returns 0 if the preset has not been fetched yet
+uint8_t tonexOne_GetCachedPresetParameters(uint8_t preset, float* values, uint16_t count)
+{
+	uint8_t result = 0;
+
+	if (preset >= MAX_TONEX_ONE_PRESETS || presetCache.entries == NULL || values == NULL)
+	{
+		return 0;
+	}
+	if (count > TONEX_PARAM_LAST)
+	{
+		count = TONEX_PARAM_LAST;
+	}
+	if (xSemaphoreTake(presetCache.mutex, pdMS_TO_TICKS(PRESET_CACHE_MUTEX_TIMEOUT_MS)) == pdTRUE)
+	{
+		if (presetCache.entries[preset].valid)
+		{
+			memcpy((void*)values, (void*)presetCache.entries[preset].parameters, count * sizeof(float));
+			result = 1;
+		}
+		xSemaphoreGive(presetCache.mutex);
+	}
+	return result;
+}
+
+void tonexOne_InvalidatePresetCache()
 {
-	input_queue = comms_queue;
+	tonexOne_PresetCacheInvalidate(PRESET_CACHE_NONE);
+}
+
+// Returns the last completed full preset download, or NULL if there is none.
+// The data is overwritten by the next download
+const uint8_t* tonexOne_GetFullPreset(uint8_t* preset, uint16_t* length)
+{
+	if (!fullPreset.valid || fullPreset.active)
+	{
+		return NULL;
+	}
+	if (preset != NULL)
+	{
+		*preset = fullPreset.preset;
+	}
+	if (length != NULL)
+	{
+		*length = fullPreset.length;
+	}
+	return fullPreset.data;
 }
 
 void tonexOne_SendHello()
 {
-	if(!cdcDeviceMounted || cdcDeviceType != CDCDeviceTonexOne)
+	if(!cdc_IsActive(tonexOneCdcSlot))
 	{
 		ESP_LOGE(TAG, "No Tonex One device mounted.");
 		return;
 	}
-	static uint8_t framedBuffer[3072];
-	uint16_t outLength;
 	ESP_LOGI(TAG, "Sent: Hello Packet");
 
 	// build message
@@ -242,209 +493,36 @@ void tonexOne_SendHello()
 								0xb9, 0x02,			// object with 2 elements
 								0x02,
 								0x0b};
-	// add framing
-	outLength = tonexOne_AddFraming(request, sizeof(request), framedBuffer);
-
-	SerialHost.write(framedBuffer, outLength);
-	SerialHost.flush();
+	TonexTxSegment segment = {request, sizeof(request)};
+	tonexOne_TransmitFramed(&segment, 1, 0);
 	tonexData->tonexState = CommsStateHello;
 }
 
 uint8_t tonexOne_HandleReceivedData(char *rxData, uint16_t len)
 {
-	// Check that the new reception will not cause a buffer overflow
-	if (len > RX_TEMP_BUFFER_SIZE)
-	{
-		// Ignore the incoming data
-		ESP_LOGD(TAG, "Buffer overflow on incoming CDC data: %d bytes overflow.", (len) - RX_TEMP_BUFFER_SIZE);
-		return 0;
-	}
-	else
-	{
-		// locate a buffer to put it
-		for (uint8_t loop = 0; loop < MAX_INPUT_BUFFERS; loop++)
-		{
-			if (inputBuffers[loop].readyToWrite == 1)
-			{
-				// Copy the received data into the raw rx buffer
-				memcpy((void*)&inputBuffers[loop].data[inputBuffers[loop].length], (void*)rxData, len);
-
-				// set buffer as used
-				inputBuffers[loop].length += len;
-				
-				// Check if a complete message has been received yet
-				if ((inputBuffers[loop].length >= 2) && (inputBuffers[loop].data[0] == FRAMING_BYTE) && (inputBuffers[loop].data[inputBuffers[loop].length - 1] == FRAMING_BYTE))
-				{
-					//ESP_LOGD(TAG, "Got new packet of length: %d", inputBuffers[loop].length);
-					inputBuffers[loop].readyToWrite = 0;
-					inputBuffers[loop].readyToRead = 1;   
-				}
+	uint8_t framesReceived = 0;
 
-				// If not, keep waiting for more data
-				else
-				{
-					//ESP_LOGD(TAG, "Missing start or end bytes. Len:%d Start:%X End:%X", len, rxData[0], rxData[len - 1]);
-				}
-				// debug
-				//ESP_LOGI(TAG, "CDC Data buffered into %d", (int)loop);
-				break;
-			}
-		}
+	// Feed the de-framer one byte at a time. Frames are processed as soon as their closing flag arrives,
+	// regardless of where the USB transfer boundaries fall
+	for (uint16_t i = 0; i < len; i++)
+	{
+		framesReceived += tonexOne_RxByte((uint8_t)rxData[i]);
 	}
-	//ESP_LOGE(TAG, "usb_tonex_one_handle_rx no available buffers!");
-
-	for (uint8_t loop = 0; loop < MAX_INPUT_BUFFERS; loop++)
-    {
-        if (inputBuffers[loop].readyToRead)
-        {
-				ESP_LOGI(TAG, "Got data via CDC %d", inputBuffers[loop].length);
-            // debug
-            //ESP_LOG_BUFFER_HEXDUMP(TAG, inputBuffers[loop].Data, inputBuffers[loop].Length, ESP_LOG_INFO);
-
-            uint16_t end_marker_pos;
-            uint16_t bytes_consumed = 0;
-            uint8_t* rx_entry_ptr = (uint8_t*)inputBuffers[loop].data;
-            uint16_t rx_entry_length = inputBuffers[loop].length;
-
-            // process all messages received (may be multiple messages appended)
-            do
-            {    
-                // locate the end of the message
-                end_marker_pos = tonexOne_LocateMessageEnd(rx_entry_ptr, rx_entry_length);
-
-                if (end_marker_pos == 0)
-                {
-                    //ESP_LOGW(TAG, "Missing end marker!");
-                    //ESP_LOG_BUFFER_HEXDUMP(TAG, rx_entry_ptr, rx_entry_length, ESP_LOG_INFO);
-                    break;
-                }
-                else
-                {
-                    //ESP_LOGI(TAG, "Found end marker: %d", end_marker_pos);
-                }
-
-                // debug
-                //ESP_LOG_BUFFER_HEXDUMP(TAG, rx_entry_ptr, end_marker_pos + 1, ESP_LOG_INFO);
-
-                // process it
-                if (tonexOne_ProcessSingleMessage(rx_entry_ptr, end_marker_pos + 1) != ESP_OK)
-                {
-                    break;    
-                }
-            
-                // skip this message
-                rx_entry_ptr += (end_marker_pos + 1);
-                bytes_consumed += (end_marker_pos + 1);
-
-                //ESP_LOGI(TAG, "After message, pos %d cons %d len %d", (int)end_marker_pos, (int)bytes_consumed, (int)rx_entry_length);
-            } while (bytes_consumed < rx_entry_length);
-
-            // set buffer as available       
-            inputBuffers[loop].readyToRead = 0;
-            inputBuffers[loop].readyToWrite = 1;   
-				inputBuffers[loop].length = 0; // reset length
-
-            vTaskDelay(2 / portTICK_PERIOD_MS); // give time to process the data
-        } 
-    }
-	 return 0;
+	return framesReceived;
 }
 
 void tonexOne_Process()
 {
-	TonexOneMessage message;
-
 	switch (tonexData->tonexState)
 	{
 		case CommsStateReady:
 		{
-				// check for any input messages
-				if (xQueueReceive(input_queue, (void*)&message, 0) == pdPASS)
+				if (tonexOne_ProcessPending() == 0 && !tonexData->stateDelta.dirty)
 				{
-					ESP_LOGI(TAG, "Got Input message: %d", message.command);
-
-					// process it
-					switch (message.command)
-					{
-						case tonexOneSetPresetCommand:
-						{
-								if (message.payload < MAX_TONEX_ONE_PRESETS)
-								{
-									// always using Stomp mode C for preset setting
-									if (tonexOne_SetPresetInSlot(message.payload, SlotC, 1) != ESP_OK)
-									{
-										// failed return to queue?
-									}
-								}
-						} break;   
-
-						case tonexOneNextPresetCommand:
-						{
-							uint8_t nextPreset = 0;
-							if (tonexData->message.slotCPreset < (MAX_TONEX_ONE_PRESETS - 1))
-								nextPreset = tonexData->message.slotCPreset + 1;
-
-							else
-								nextPreset = 0;
-
-							// always using Stomp mode C for preset setting
-							if (tonexOne_SetPresetInSlot(nextPreset, SlotC, 1) != ESP_OK)
-							{
-								ESP_LOGE(TAG, "Failed to set next preset!");
-							}
-							else
-							{
-								ESP_LOGI(TAG, "Set next preset successfully!");
-							}
-						} break;
-
-						case tonexOnePreviousPresetCommand:
-						{
-							uint8_t previousPreset = 0;
-							if (tonexData->message.slotCPreset > 0)
-								tonexData->message.slotCPreset - 1;
-							else
-								previousPreset = MAX_TONEX_ONE_PRESETS - 1;
-
-							// always using Stomp mode C for preset setting
-							if (tonexOne_SetPresetInSlot(tonexData->message.slotCPreset - 1, SlotC, 1) != ESP_OK)
-							{
-								ESP_LOGE(TAG, "Failed to set previous preset!");
-							}
-							else
-							{
-								ESP_LOGI(TAG, "Set previous preset successfully!");
-							}
-						} break;
-
-						case tonexOneModifyParameterCommand:
-						{
-								if (message.payload < TONEX_PARAM_LAST)
-								{
-									// modify the param
-									tonexOne_ModifyParameter(message.payload, message.payloadFloat);
-
-									// send it
-									tonexOne_SendSingleParameter(message.payload, message.payloadFloat);
-								}
-								else if (message.payload < TONEX_GLOBAL_LAST)
-								{
-									// modify the global
-									tonexOne_ModifyGlobal(message.payload, message.payloadFloat);
-
-									// debug
-									//usb_tonex_one_dump_state(&TonexData->Message.PedalData.TonexStateData);
-
-									// send it by setting the same preset active again, which sends the state data
-									tonexOne_SetPresetInSlot(tonexData->message.slotCPreset, SlotC, 1);
-								}
-								else
-								{
-									ESP_LOGW(TAG, "Attempt to modify unknown param %d", (int)message.payload);
-								}
-						} break;
-					}
+					// nothing from the user, so use the idle link to fill the preset cache
+					tonexOne_PresetCachePrefetch();
 				}
+				tonexOne_StateDeltaProcess();
 				// Check for that a state update was received in time when changing presets
 				if(presetChangeSent == 1 && stateDataReceived == 0)
 				{
@@ -474,12 +552,12 @@ void tonexOne_PreviousPreset()
 {
 	uint8_t previousPreset = 0;
 	if (tonexData->message.slotCPreset > 0)
-		tonexData->message.slotCPreset - 1;
+		previousPreset = tonexData->message.slotCPreset - 1;
 	else
 		previousPreset = MAX_TONEX_ONE_PRESETS - 1;
 
 	// always using Stomp mode C for preset setting
-	if (tonexOne_SetPresetInSlot(tonexData->message.slotCPreset - 1, SlotC, 1) != ESP_OK)
+	if (tonexOne_SetPresetInSlot(previousPreset, SlotC, 1) != ESP_OK)
 	{
 		ESP_LOGE(TAG, "Failed to set previous preset!");
 	}
@@ -492,14 +570,8 @@ void tonexOne_PreviousPreset()
 void tonexOne_NextPreset()
 {
 	uint8_t nextPreset = 0;
-	ESP_LOGD(TAG, "\n1\n");
 	if (tonexData->message.slotCPreset < (MAX_TONEX_ONE_PRESETS - 1))
-	{
-		ESP_LOGD(TAG, "\n1\n");
 		nextPreset = tonexData->message.slotCPreset + 1;
-		ESP_LOGD(TAG, "\n1\n");
-	}
-
 	else
 		nextPreset = 0;
 
@@ -516,135 +588,256 @@ void tonexOne_NextPreset()
 
 
 //---------------------- Private Functions ----------------------//
+// Only one pedal is driven at a time, as the state and caches here are single instance
+uint8_t tonexOne_CdcInit(uint8_t slot)
+{
+	if (tonexOneCdcSlot != CDC_SLOT_NONE)
+	{
+		ESP_LOGW(TAG, "Tonex One already connected in slot %d", (int)tonexOneCdcSlot);
+		return 0;
+	}
+	tonexOneCdcSlot = slot;
+	tonexOne_Init();
+	if (tonexData == NULL)
+	{
+		tonexOneCdcSlot = CDC_SLOT_NONE;
+		return 0;
+	}
+	tonexOne_InterfaceInit();
+	tonexOne_SendHello();
+	return 1;
+}
+
+void tonexOne_CdcDeinit(uint8_t slot)
+{
+	if (slot != tonexOneCdcSlot)
+	{
+		return;
+	}
+	tonexOneCdcSlot = CDC_SLOT_NONE;
+	tonexOne_RxResetFrame(RxFramingHunt);
+	tonexOne_InvalidatePresetCache();
+	if (tonexData != NULL)
+	{
+		tonexData->tonexState = CommsStateIdle;
+	}
+	ESP_LOGI(TAG, "Tonex One disconnected");
+}
+
+void tonexOne_CdcRx(uint8_t slot, uint8_t* data, uint16_t length)
+{
+	tonexOne_HandleReceivedData((char*)data, length);
+}
+
+void tonexOne_CdcTick(uint8_t slot)
+{
+	tonexOne_Process();
+}
+
+// Sends the commands queued through tonexOne_Interface. Returns the number of commands sent
+uint8_t tonexOne_ProcessPending(void)
+{
+	int16_t target;
+	int16_t offset;
+	int16_t preset = (presetChangeSent && !stateDataReceived) ? presetChangeTarget : tonexData->message.slotCPreset;
+	uint8_t presetChange = 0;
+	uint8_t globalCount = 0;
+	uint16_t params[TONEX_ONE_COMMAND_BATCH];
+	float values[TONEX_ONE_COMMAND_BATCH];
+	uint8_t paramCount = 0;
+
+	if (tonexOne_InterfaceTakePreset(&target, &offset))
+	{
+		if (target != TONEX_ONE_PRESET_RELATIVE)
+		{
+			preset = target;
+		}
+		preset = (preset + offset) % MAX_TONEX_ONE_PRESETS;
+		if (preset < 0)
+		{
+			preset += MAX_TONEX_ONE_PRESETS;
+		}
+		presetChange = 1;
+	}
+
+	while (paramCount < TONEX_ONE_COMMAND_BATCH && tonexOne_InterfaceTakeParameter(&params[paramCount], &values[paramCount]))
+	{
+		if (params[paramCount] > TONEX_PARAM_LAST)
+		{
+			// globals live in the state data, which is sent once the edits settle
+			tonexOne_ModifyGlobal(params[paramCount], values[paramCount]);
+			globalCount++;
+		}
+		else
+		{
+			paramCount++;
+		}
+	}
+
+	// sending the preset also sends the state data, so it carries any global changes
+	if (presetChange)
+	{
+		// always using Stomp mode C for preset setting
+		if (tonexOne_SetPresetInSlot(preset, SlotC, 1) != ESP_OK)
+		{
+			ESP_LOGE(TAG, "Failed to set preset %d!", (int)preset);
+		}
+	}
+
+	// parameter writes still pending were made after the preset change, so they go after it
+	for (uint8_t i = 0; i < paramCount; i++)
+	{
+		tonexOne_ModifyParameter(params[i], values[i]);
+		tonexOne_SendSingleParameter(params[i], values[i]);
+	}
+
+	return presetChange + globalCount + paramCount;
+}
+
 esp_err_t tonexOne_ProcessSingleMessage(uint8_t* data, uint16_t length)
 {
 	ESP_LOGD(TAG, "Processing message of length %d", (int)length);
     void* temp_ptr;  
     uint16_t current_preset;
 
-    // check if we got a complete message(s)
-    if ((length >= 2) && (data[0] == 0x7E) && (data[length - 1] == 0x7E))
+    // data holds a single de-framed message that has already passed its CRC check
+    ESP_LOGI(TAG, "Processing messages len: %d", (int)length);
+    ParsingStatus status = tonexOne_ParsePacket(data, length);
+
+    if (status != ParsingOk)
+    {
+        ESP_LOGE(TAG, "Error parsing message: %d", (int)status);
+        return ESP_FAIL;
+    }
+    else
     {
-        ESP_LOGI(TAG, "Processing messages len: %d", (int)length);
-        ParsingStatus status = tonexOne_ParsePacket(data, length);
+        ESP_LOGI(TAG, "Message Header type: %d", (int)tonexData->message.header.type);
 
-        if (status != ParsingOk)
-        {
-            ESP_LOGE(TAG, "Error parsing message: %d", (int)status);
-        }
-        else
+        // check what we got
+        switch (tonexData->message.header.type)
         {
-            ESP_LOGI(TAG, "Message Header type: %d", (int)tonexData->message.header.type);
-
-            // check what we got
-            switch (tonexData->message.header.type)
+            case PacketStateUpdate:
             {
-                case PacketStateUpdate:
+                current_preset = tonexOne_GetCurrentActivePreset();
+                ESP_LOGI(TAG, "Received State Update. Current slot: %d. Preset: %d", (int)tonexData->message.currentSlot, (int)current_preset);
+                
+                // debug
+                //ESP_LOG_BUFFER_HEXDUMP(TAG, data, length, ESP_LOG_INFO);
+
+                tonexData->tonexState = CommsStateReady;   
+
+                // edits are saved or dropped by the pedal when their preset is left
+                if (presetCache.editedPreset != PRESET_CACHE_NONE && presetCache.editedPreset != current_preset)
+                {
+                    tonexOne_PresetCacheInvalidate(presetCache.editedPreset);
+                    presetCache.editedPreset = PRESET_CACHE_NONE;
+                }
+
+                if (bootInitNeeded)
                 {
-                    current_preset = tonexOne_GetCurrentActivePreset();
-                    ESP_LOGI(TAG, "Received State Update. Current slot: %d. Preset: %d", (int)tonexData->message.currentSlot, (int)current_preset);
-                    
-                    // debug
-                    //ESP_LOG_BUFFER_HEXDUMP(TAG, data, length, ESP_LOG_INFO);
-
-                    tonexData->tonexState = CommsStateReady;   
-
-                    if (bootInitNeeded)
-                    {
-                        // request details of the current preset, so we can update UI
-                        tonexOne_RequestPresetDetails(current_preset, 0);
-                        bootInitNeeded = 0;
-                    }
-                    else
-                    {
-                        // signal to refresh param UI with Globals
-                        //UI_RefreshParameterValues();
-
-                        // update web UI
-                        //wifi_request_sync(WIFI_SYNC_TYPE_PARAMS, NULL, NULL);
-                    }
-                } break;
-
-                case PacketStatePresetDetails:
+                    // request details of the current preset, so we can update UI
+                    tonexOne_PresetCacheHoldoff();
+                    tonexOne_RequestPresetDetails(current_preset, 0);
+                    bootInitNeeded = 0;
+                }
+                else
                 {
-                    // locate the ToneOnePresetByteMarker[] to get preset name
-                    temp_ptr = memmem((void*)data, length, (void*)presetByteMarker, sizeof(presetByteMarker));
-                    if (temp_ptr != NULL)
-                    {
-                        ESP_LOGI(TAG, "Got preset name");
-
-                        // grab name
-                        memcpy((void*)preset_name, (void*)(temp_ptr + sizeof(presetByteMarker)), TONEX_ONE_RESP_OFFSET_PRESET_NAME_LEN);                
-                    }
-
-                    current_preset = tonexOne_GetCurrentActivePreset();
-                    ESP_LOGI(TAG, "Received State Update. Current slot: %d. Preset: %d", (int)tonexData->message.currentSlot, (int)current_preset);
-                    
-                    // make sure we are showing the correct preset as active                
-                    //control_sync_preset_details(current_preset, preset_name);
-
-                    // read the preset params
-                    tonexOne_ParsePresetParameters(data, length);
-
-                    // signal to refresh param UI
+                    // signal to refresh param UI with Globals
                     //UI_RefreshParameterValues();
 
                     // update web UI
                     //wifi_request_sync(WIFI_SYNC_TYPE_PARAMS, NULL, NULL);
+                }
+            } break;
 
-                    // debug dump parameters
-                    //tonex_dump_parameters();
-                } break;
+            case PacketStatePresetDetails:
+            {
+                if (presetCache.pendingPreset != PRESET_CACHE_NONE)
+                {
+                    // answer to a background prefetch, leave the live preset alone
+                    tonexOne_PresetCacheStore(presetCache.pendingPreset, data, length);
+                    presetCache.pendingPreset = PRESET_CACHE_NONE;
+                    break;
+                }
 
-                case PacketHello:
+                // locate the ToneOnePresetByteMarker[] to get preset name
+                temp_ptr = memmem((void*)data, length, (void*)presetByteMarker, sizeof(presetByteMarker));
+                if (temp_ptr != NULL)
                 {
-                    ESP_LOGI(TAG, "Received Hello");
+                    ESP_LOGI(TAG, "Got preset name");
+
+                    // grab name
+                    memcpy((void*)preset_name, (void*)(temp_ptr + sizeof(presetByteMarker)), TONEX_ONE_RESP_OFFSET_PRESET_NAME_LEN);                
+                }
 
-                    // get current state
-                    tonexOne_RequestState();
-                    tonexData->tonexState = CommsStateGetState;
+                current_preset = tonexOne_GetCurrentActivePreset();
+                ESP_LOGI(TAG, "Received State Update. Current slot: %d. Preset: %d", (int)tonexData->message.currentSlot, (int)current_preset);
+                
+                // make sure we are showing the correct preset as active                
+                //control_sync_preset_details(current_preset, preset_name);
 
-                    // flag that we need to do the boot init procedure
-                    bootInitNeeded = 1;
-                } break;
+                // read the preset params
+                tonexOne_ParsePresetParameters(data, length);
+                tonexOne_PresetCacheStore(current_preset, data, length);
 
-                case PacketStatePresetDetailsFull:
-                {
-                    // ignore
-                    ESP_LOGI(TAG, "Received Preset details full");
-                } break;
+                // signal to refresh param UI
+                //UI_RefreshParameterValues();
+
+                // update web UI
+                //wifi_request_sync(WIFI_SYNC_TYPE_PARAMS, NULL, NULL);
+
+                // debug dump parameters
+                //tonex_dump_parameters();
+            } break;
+
+            case PacketHello:
+            {
+                ESP_LOGI(TAG, "Received Hello");
+
+                // get current state
+                tonexOne_RequestState();
+                tonexData->tonexState = CommsStateGetState;
+
+                // flag that we need to do the boot init procedure
+                bootInitNeeded = 1;
+
+                // may be a different pedal or a power cycle, start the cache again
+                tonexOne_PresetCacheInvalidate(PRESET_CACHE_NONE);
+                presetCache.pendingPreset = PRESET_CACHE_NONE;
+                presetCache.editedPreset = PRESET_CACHE_NONE;
+            } break;
+
+            case PacketStateParamChanged:
+            {
+                // the cached copy of the active preset goes stale, but refetching it on every edit
+                // would follow each CC sweep, so it is only refetched once the preset is left
+                presetCache.editedPreset = tonexOne_GetCurrentActivePreset();
+            } break;
+
+            case PacketStatePresetDetailsFull:
+            {
+                ESP_LOGI(TAG, "Received Preset details full. Preset: %d, name: %s", (int)fullPreset.preset, fullPreset.name);
 
-                default:
+                if (fullPresetProgressCallback != NULL)
                 {
-                    ESP_LOGI(TAG, "Message unknown %d", (int)tonexData->message.header.type);
-                } break;
-            }
-        }
+                    fullPresetProgressCallback(fullPreset.total, fullPreset.total);
+                }
 
-        return ESP_OK;
-    }
-    else
-    {
-        ESP_LOGW(TAG, "Missing start or end bytes. %d, %d, %d", (int)length, (int)data[0], (int)data[length - 1]);
-        //ESP_LOG_BUFFER_HEXDUMP(TAG, data, length, ESP_LOG_INFO);
-        return ESP_FAIL;
-    }
-}
+                // the live parameters only follow the preset that is actually loaded
+                if (fullPreset.preset == tonexOne_GetCurrentActivePreset())
+                {
+                    tonexOne_ApplyFullPresetParameters();
+                }
+            } break;
 
-uint16_t tonexOne_LocateMessageEnd(uint8_t* data, uint16_t length)
-{
-    // locate the 0x7E end of packet marker
-    // starting at index 1 to skip the start marker
-    for (uint16_t loop = 1; loop < length; loop++)
-    {
-        if (data[loop] == 0x7E)
-        {
-            return loop;
+            default:
+            {
+                ESP_LOGI(TAG, "Message unknown %d", (int)tonexData->message.header.type);
+            } break;
         }
     }
 
-    // not found
-    return 0;
+    return ESP_OK;
 }
 
 void tonexOne_DumpState()
@@ -729,10 +922,190 @@ void tonexOne_ParsePresetParameters(uint8_t* raw_data, uint16_t length)
     }
 }
 
+void tonexOne_ApplyFullPresetParameters(void)
+{
+	tTonexParameter* param_ptr = NULL;
+
+	if (fullPreset.parser.paramIndex < TONEX_PARAM_LAST)
+	{
+		ESP_LOGW(TAG, "Full preset parameters incomplete: %d", (int)fullPreset.parser.paramIndex);
+		return;
+	}
+
+	// values were collected while the frame streamed in, so the lock is only held for the copy
+	if (tonex_params_get_locked_access(&param_ptr) == ESP_OK)
+	{
+		for (uint32_t loop = 0; loop < TONEX_PARAM_LAST; loop++)
+		{
+			param_ptr[loop].Value = fullPreset.parser.values[loop];
+		}
+		tonex_params_release_locked_access();
+	}
+}
+
+// name must hold TONEX_ONE_RESP_OFFSET_PRESET_NAME_LEN + 1 bytes
+void tonexOne_ExtractPresetName(uint8_t* data, uint16_t length, char* name)
+{
+	name[0] = 0;
+
+	uint8_t* temp_ptr = (uint8_t*)memmem((void*)data, length, (void*)presetByteMarker, sizeof(presetByteMarker));
+	if (temp_ptr != NULL)
+	{
+		temp_ptr += sizeof(presetByteMarker);
+		uint16_t nameLength = (data + length) - temp_ptr;
+		if (nameLength > TONEX_ONE_RESP_OFFSET_PRESET_NAME_LEN)
+		{
+			nameLength = TONEX_ONE_RESP_OFFSET_PRESET_NAME_LEN;
+		}
+		memcpy((void*)name, (void*)temp_ptr, nameLength);
+		name[nameLength] = 0;
+	}
+}
+
+// Called before every user initiated preset change or details request. A prefetch already sent is
+// still tracked, the pedal answers in order so its reply arrives first and goes to the cache
+void tonexOne_PresetCacheHoldoff(void)
+{
+	presetCache.holdoffTime = millis();
+}
+
+// Returns the preset an incoming details reply belongs to, or PRESET_CACHE_NONE for a live reply.
+// A prefetch whose reply never came stops claiming replies once it times out
+uint8_t tonexOne_PresetCacheReplyPreset(void)
+{
+	if (presetCache.pendingPreset != PRESET_CACHE_NONE
+		&& (millis() - presetCache.requestTime) >= PRESET_CACHE_REQUEST_TIMEOUT_MS)
+	{
+		ESP_LOGW(TAG, "Preset cache request for %d timed out", (int)presetCache.pendingPreset);
+		presetCache.pendingPreset = PRESET_CACHE_NONE;
+	}
+	return presetCache.pendingPreset;
+}
+
+// Requests the details of one uncached preset at a time, only while the link is otherwise quiet
+void tonexOne_PresetCachePrefetch(void)
+{
+	uint32_t now = millis();
+
+	if (presetCache.entries == NULL)
+	{
+		return;
+	}
+
+	if (tonexOne_PresetCacheReplyPreset() != PRESET_CACHE_NONE)
+	{
+		return;
+	}
+
+	// keep out of the way of user initiated traffic
+	if (bootInitNeeded || fullPreset.active || (presetChangeSent && !stateDataReceived)
+		|| ((now - presetCache.holdoffTime) < PRESET_CACHE_HOLDOFF_MS)
+		|| ((now - presetCache.requestTime) < PRESET_CACHE_REQUEST_INTERVAL_MS))
+	{
+		return;
+	}
+
+	for (uint8_t i = 0; i < MAX_TONEX_ONE_PRESETS; i++)
+	{
+		uint8_t preset = (presetCache.nextPreset + i) % MAX_TONEX_ONE_PRESETS;
+		if (!presetCache.entries[preset].valid)
+		{
+			if (tonexOne_RequestPresetDetails(preset, 0) == ESP_OK)
+			{
+				presetCache.pendingPreset = preset;
+				presetCache.nextPreset = (preset + 1) % MAX_TONEX_ONE_PRESETS;
+			}
+			presetCache.requestTime = now;
+			return;
+		}
+	}
+}
+
+void tonexOne_PresetCacheStore(uint8_t preset, uint8_t* data, uint16_t length)
+{
+	char name[TONEX_ONE_RESP_OFFSET_PRESET_NAME_LEN + 1];
+
+	if (preset >= MAX_TONEX_ONE_PRESETS || presetCache.entries == NULL)
+	{
+		return;
+	}
+
+	// parse outside of the lock, readers only wait for the copy
+	tonexOne_ExtractPresetName(data, length, name);
+	memset((void*)&presetCache.parser, 0, sizeof(presetCache.parser));
+	presetCache.parser.state = ParamParserMarker;
+	for (uint16_t i = 0; i < length; i++)
+	{
+		tonexOne_ParamParserByte(&presetCache.parser, data[i]);
+	}
+	if (presetCache.parser.paramIndex < TONEX_PARAM_LAST)
+	{
+		ESP_LOGW(TAG, "Preset %d details incomplete, not cached", (int)preset);
+		return;
+	}
+
+	if (xSemaphoreTake(presetCache.mutex, pdMS_TO_TICKS(PRESET_CACHE_MUTEX_TIMEOUT_MS)) == pdTRUE)
+	{
+		memcpy((void*)presetCache.entries[preset].name, (void*)name, sizeof(name));
+		memcpy((void*)presetCache.entries[preset].parameters, (void*)presetCache.parser.values, sizeof(presetCache.entries[preset].parameters));
+		presetCache.entries[preset].valid = 1;
+		xSemaphoreGive(presetCache.mutex);
+		ESP_LOGI(TAG, "Cached preset %d: %s", (int)preset, name);
+	}
+}
+
+// PRESET_CACHE_NONE invalidates every preset
+void tonexOne_PresetCacheInvalidate(uint8_t preset)
+{
+	if (presetCache.entries == NULL)
+	{
+		return;
+	}
+	if (xSemaphoreTake(presetCache.mutex, pdMS_TO_TICKS(PRESET_CACHE_MUTEX_TIMEOUT_MS)) == pdTRUE)
+	{
+		for (uint8_t i = 0; i < MAX_TONEX_ONE_PRESETS; i++)
+		{
+			if (preset == PRESET_CACHE_NONE || preset == i)
+			{
+				presetCache.entries[i].valid = 0;
+			}
+		}
+		xSemaphoreGive(presetCache.mutex);
+	}
+}
+
+ParsingStatus tonexOne_ParsePresetDetailsFull(uint8_t* unframed, uint16_t length, uint16_t index)
+{
+	tonexData->message.header.type = PacketStatePresetDetailsFull;
+
+	// the frame must have been streamed into the full preset store
+	if (!fullPreset.active || unframed != fullPreset.data)
+	{
+		ESP_LOGW(TAG, "Full preset details received outside of the preset store");
+		return ParsingInvalidFrame;
+	}
+
+	fullPreset.active = 0;
+	fullPreset.length = length;
+	fullPreset.preset = fullPreset.requestedPreset;
+	fullPreset.requestedPreset = 0xFF;
+	tonexOne_ExtractPresetName(&unframed[index], length - index, fullPreset.name);
+	fullPreset.valid = 1;
+
+	ESP_LOGI(TAG, "Saved Full Preset Details: %d", (int)(length - index));
+	return ParsingOk;
+}
+
 ParsingStatus tonexOne_ParsePresetDetails(uint8_t* unframed, uint16_t length, uint16_t index)
 {
     tonexData->message.header.type = PacketStatePresetDetails;
 
+    if (tonexOne_PresetCacheReplyPreset() != PRESET_CACHE_NONE)
+    {
+        // prefetched details only go to the preset cache
+        return ParsingOk;
+    }
+
     tonexData->message.pedalData.presetDataLength = length - index;
     memcpy((void*)tonexData->message.pedalData.presetData, (void*)&unframed[index], tonexData->message.pedalData.presetDataLength);
     ESP_LOGI(TAG, "Saved Preset Details: %d", tonexData->message.pedalData.presetDataLength);
@@ -746,35 +1119,28 @@ ParsingStatus tonexOne_ParsePresetDetails(uint8_t* unframed, uint16_t length, ui
 
 esp_err_t tonexOne_RequestState(void)
 {
-	if(!cdcDeviceMounted || cdcDeviceType != CDCDeviceTonexOne)
+	if(!cdc_IsActive(tonexOneCdcSlot))
 	{
 		ESP_LOGE(TAG, "No Tonex One device mounted.");
 		return ESP_FAIL;
 	}
-	uint16_t outLength;
-
 	// build message
 	uint8_t request[] = {0xb9, 0x03, 0x00, 0x82, 0x06, 0x00, 0x80, 0x0b, 0x03, 0xb9, 0x02, 0x81, 0x06, 0x03, 0x0b};
-
-	// add framing
-	outLength = tonexOne_AddFraming(request, sizeof(request), framedBuffer);
+	TonexTxSegment segment = {request, sizeof(request)};
 
 	// send it
 	ESP_LOGD(TAG, "Sent: Request State\n");
-	SerialHost.write(framedBuffer, outLength);
-	SerialHost.flush();
+	tonexOne_TransmitFramed(&segment, 1, 0);
 	return 0;
 }
 
 esp_err_t tonexOne_SetActiveSlot(Slot newSlot)
 {
-	if(!cdcDeviceMounted || cdcDeviceType != CDCDeviceTonexOne)
+	if(!cdc_IsActive(tonexOneCdcSlot))
 	{
 		ESP_LOGE(TAG, "No Tonex One device mounted.");
 		return ESP_FAIL;
 	}
-	uint16_t framedLength;
-
 	ESP_LOGI(TAG, "Setting slot %d", (int)newSlot);
 
 	// Build message, length to 0 for now                    len LSB  len MSB
@@ -790,17 +1156,14 @@ esp_err_t tonexOne_SetActiveSlot(Slot newSlot)
 	// modify the buffer with the new slot
 	tonexData->message.pedalData.stateData[tonexData->message.pedalData.stateDataLength - TONEX_STATE_OFFSET_END_CURRENT_SLOT + 7] = (uint8_t)newSlot;
 
-	// build total message
-	memcpy((void *)txBuffer, (void *)message, sizeof(message));
-	memcpy((void *)&txBuffer[sizeof(message)], (void *)tonexData->message.pedalData.stateData, tonexData->message.pedalData.stateDataLength);
-
-	// add framing
-	framedLength = tonexOne_AddFraming(txBuffer, sizeof(message) + tonexData->message.pedalData.stateDataLength, framedBuffer);
+	// header and state are framed straight from where they are
+	TonexTxSegment segments[] = {
+		{message, sizeof(message)},
+		{tonexData->message.pedalData.stateData, tonexData->message.pedalData.stateDataLength}};
 
 	// send it
 	ESP_LOGD(TAG, "Sent: Set Active Slot: %d\n", newSlot);
-	SerialHost.write(framedBuffer, framedLength);
-	SerialHost.flush();
+	tonexOne_TransmitFramed(segments, 2, 0);
 	return 0;
 }
 
@@ -835,24 +1198,17 @@ uint16_t tonexOne_GetCurrentActivePreset(void)
 
 esp_err_t tonexOne_SetPresetInSlot(uint16_t preset, Slot newSlot, uint8_t selectSlot)
 {
-	if(!cdcDeviceMounted || cdcDeviceType != CDCDeviceTonexOne)
+	if(!cdc_IsActive(tonexOneCdcSlot))
 	{
 		ESP_LOGE(TAG, "No Tonex One device mounted.");
 		return ESP_FAIL;
 	}
-	uint16_t framedLength;
 	presetChangeSentTime = millis();
 	presetChangeSent = 1;
+	tonexOne_PresetCacheHoldoff();
 	stateDataReceived = 0;
 	ESP_LOGI(TAG, "Setting preset %d in slot %d", (int)preset, (int)newSlot);
 
-	// Build message, length to 0 for now                    len LSB  len MSB
-	uint8_t message[] = {0xb9, 0x03, 0x81, 0x06, 0x03, 0x82, 0, 0, 0x80, 0x0b, 0x03};
-
-	// set length
-	message[6] = tonexData->message.pedalData.stateDataLength & 0xFF;
-	message[7] = (tonexData->message.pedalData.stateDataLength >> 8) & 0xFF;
-
 	// force pedal to Stomp mode. 0 here = A/B mode, 1 = stomp mode
 	tonexData->message.pedalData.stateData[TONEX_STATE_OFFSET_START_STOMP_MODE] = 1;
 
@@ -908,6 +1264,7 @@ esp_err_t tonexOne_SetPresetInSlot(uint16_t preset, Slot newSlot, uint8_t select
 	case SlotC:
 	{
 		tonexData->message.pedalData.stateData[tonexData->message.pedalData.stateDataLength - TONEX_STATE_OFFSET_END_SLOT_C_PRESET] = preset;
+		presetChangeTarget = preset;
 	}
 	break;
 	}
@@ -918,74 +1275,98 @@ esp_err_t tonexOne_SetPresetInSlot(uint16_t preset, Slot newSlot, uint8_t select
 		tonexData->message.pedalData.stateData[tonexData->message.pedalData.stateDataLength - TONEX_STATE_OFFSET_END_CURRENT_SLOT] = (uint8_t)newSlot;
 	}
 
-	// ESP_LOGI(TAG, "State Data after changes");
-	// ESP_LOGD_BUFFER_HEXDUMP(TAG, tonexData->message.pedalData.RawData, tonexData->message.pedalData.Length, ESP_LOGD_INFO);
+	return tonexOne_SendState();
+}
 
-	// build total message
-	memcpy((void *)txBuffer, (void *)message, sizeof(message));
-	memcpy((void *)&txBuffer[sizeof(message)], (void *)tonexData->message.pedalData.stateData, tonexData->message.pedalData.stateDataLength);
-
-	// do framing
-	framedLength = tonexOne_AddFraming(txBuffer, sizeof(message) + tonexData->message.pedalData.stateDataLength, framedBuffer);
-	
-	// Before sending the packet, pad the packet with zeros to the nearest 64-byte boundary
-	
-	uint8_t padding = 64 - (framedLength % 64);
-
-
-	if (padding < 64)
-	{
-		framedBuffer[framedLength] = 0x7e; // add end marker to the end of the packet
-		framedLength++;
-		memset((void *)&framedBuffer[framedLength], 0x00, padding-2);
-		framedLength += padding-2;
-	}
-	framedBuffer[framedLength] = 0x7e;
-	framedLength++;
-	
-
-	//size_t sentBytes = cdc_Transmit(framedBuffer, framedLength);
-	size_t sentBytes = SerialHost.write(framedBuffer, 63);
-	SerialHost.flush();
-	sentBytes = SerialHost.write(&framedBuffer[63], 63);
-	SerialHost.flush();
-	sentBytes = SerialHost.write(&framedBuffer[126], 48);
-	SerialHost.flush();
-	
-/*
-	size_t sentBytes = SerialHost.write(framedBuffer, 64);
-	while(SerialHost.availableForWrite() < 64)
-	{
-		//vTaskDelay(1 / portTICK_PERIOD_MS);
-		usbh_Process();
-	}
-	delay(1);
-	//SerialHost.flush();
-	//delay(5);
-	
-	//vTaskDelay(5 / portTICK_PERIOD_MS);
-	sentBytes = SerialHost.write(&framedBuffer[64], 64);
-	while(SerialHost.availableForWrite() < 64)
-	{
-		//vTaskDelay(1 / portTICK_PERIOD_MS);
-		usbh_Process();
-	}
-	delay(1);
-	//SerialHost.flush();
-	//vTaskDelay(5 / portTICK_PERIOD_MS);
-	//delay(5);
-	sentBytes = SerialHost.write(&framedBuffer[128], 64);
-	SerialHost.flush();
-	*/
-	ESP_LOGE(TAG, "Data Transmit Complete: %d (%d from driver)", (int)framedLength, sentBytes);
+// Sends the whole state blob. The pedal has no partial state write, so the delta tracking
+// only decides when this is needed
+esp_err_t tonexOne_SendState(void)
+{
+	// Build message, length to 0 for now                    len LSB  len MSB
+	uint8_t message[] = {0xb9, 0x03, 0x81, 0x06, 0x03, 0x82, 0, 0, 0x80, 0x0b, 0x03};
 
-	return 0;
+	// set length
+	message[6] = tonexData->message.pedalData.stateDataLength & 0xFF;
+	message[7] = (tonexData->message.pedalData.stateDataLength >> 8) & 0xFF;
+
+	TonexTxSegment segments[] = {
+		{message, sizeof(message)},
+		{tonexData->message.pedalData.stateData, tonexData->message.pedalData.stateDataLength}};
+
+	// the state now on its way includes every local edit
+	tonexData->stateDelta.dirty = 0;
+
+	// the state write is padded out to a whole number of 64-byte packets
+	if (tonexOne_TransmitFramed(segments, 2, 1) != ESP_OK)
+	{
+		ESP_LOGE(TAG, "State write of %d bytes failed", (int)tonexData->message.pedalData.stateDataLength);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+// Writes into stateData, extending the dirty range only if the bytes actually change
+void tonexOne_StateWrite(uint16_t offset, const void* data, uint16_t length)
+{
+	StateDelta* delta = &tonexData->stateDelta;
+	uint32_t now = millis();
+
+	if ((offset + length) > tonexData->message.pedalData.stateDataLength)
+	{
+		return;
+	}
+	if (memcmp((void*)&tonexData->message.pedalData.stateData[offset], data, length) == 0)
+	{
+		return;
+	}
+	memcpy((void*)&tonexData->message.pedalData.stateData[offset], data, length);
+
+	if (!delta->dirty)
+	{
+		delta->start = offset;
+		delta->end = offset + length;
+		delta->firstChangeTime = now;
+		delta->dirty = 1;
+	}
+	else
+	{
+		if (offset < delta->start)
+		{
+			delta->start = offset;
+		}
+		if ((offset + length) > delta->end)
+		{
+			delta->end = offset + length;
+		}
+	}
+	delta->lastChangeTime = now;
+}
+
+// Sends one state write per burst of global edits
+void tonexOne_StateDeltaProcess(void)
+{
+	StateDelta* delta = &tonexData->stateDelta;
+	uint32_t now = millis();
+
+	if (!delta->dirty)
+	{
+		return;
+	}
+	if (((now - delta->lastChangeTime) < STATE_DEBOUNCE_MS) && ((now - delta->firstChangeTime) < STATE_MAX_LATENCY_MS))
+	{
+		return;
+	}
+
+	ESP_LOGD(TAG, "Sending state, changed bytes %d-%d", (int)delta->start, (int)delta->end);
+	if (tonexOne_SendState() != ESP_OK)
+	{
+		ESP_LOGE(TAG, "Failed to send state!");
+	}
 }
 
 esp_err_t tonexOne_RequestPresetDetails(uint8_t preset_index, uint8_t full_details)
 {
-	esp_err_t res = ESP_FAIL;
-	uint16_t outLength;
+	esp_err_t res;
 
 	ESP_LOGI(TAG, "Requesting full preset details for %d", (int)preset_index);
 
@@ -994,44 +1375,23 @@ esp_err_t tonexOne_RequestPresetDetails(uint8_t preset_index, uint8_t full_detai
 	request[15] = preset_index;
 	request[16] = full_details;     // 0x00 = approx 2k byte summary. 0x01 = approx 30k byte full preset details
 
-	// add framing
-	outLength = tonexOne_AddFraming(request, sizeof(request), framedBuffer);
+	TonexTxSegment segment = {request, sizeof(request)};
 
 	// send it
 	ESP_LOGD(TAG, "Sent: Request Full Preset Details\n");
-	SerialHost.write(framedBuffer, outLength);
-	SerialHost.flush();
+	res = tonexOne_TransmitFramed(&segment, 1, 0);
 	return res;
 }
 
-ParsingStatus tonexOne_ParsePacket(uint8_t *message, uint16_t inlength)
+ParsingStatus tonexOne_ParsePacket(uint8_t *message, uint16_t length)
 {
-	uint16_t out_len = 0;
-
-	ParsingStatus status = tonexOne_RemoveFraming(message, inlength, framedBuffer, &out_len);
-
-	/*
-	Serial0.print("De-framed message: ");
-	for(uint16_t i=0; i<out_len; i++)
-	{
-		Serial0.print(framedBuffer[i], HEX);
-		Serial0.print(" ");
-	}
-	Serial0.println();
-	*/
-	if (status != ParsingOk)
-	{
-		ESP_LOGD(TAG, "Remove framing failed");
-		return ParsingInvalidFrame;
-	}
-
-	if (out_len < 5)
+	if (length < 5)
 	{
 		ESP_LOGD(TAG, "Message too short");
 		return ParsingInvalidFrame;
 	}
 
-	if ((framedBuffer[0] != 0xB9) || (framedBuffer[1] != 0x03))
+	if ((message[0] != 0xB9) || (message[1] != 0x03))
 	{
 		ESP_LOGD(TAG, "Invalid header");
 		return ParsingInvalidFrame;
@@ -1039,7 +1399,7 @@ ParsingStatus tonexOne_ParsePacket(uint8_t *message, uint16_t inlength)
 
 	PacketHeader header;
 	uint8_t index = 2;
-	uint16_t type = tonexOne_ParseValue(framedBuffer, &index);
+	uint16_t type = tonexOne_ParseValue(message, &index);
 
 	switch (type)
 	{
@@ -1075,14 +1435,14 @@ ParsingStatus tonexOne_ParsePacket(uint8_t *message, uint16_t inlength)
 	} break;
 	};
 
-	header.size = tonexOne_ParseValue(framedBuffer, &index);
-	header.unknown = tonexOne_ParseValue(framedBuffer, &index);
+	header.size = tonexOne_ParseValue(message, &index);
+	header.unknown = tonexOne_ParseValue(message, &index);
 	ESP_LOGI(TAG, "TonexOne Parse: type: %d size: %d", (int)header.type, (int)header.size);
 
 	// ESP_LOGI(TAG, "Structure ID: %d", header.type);
 	// ESP_LOGI(TAG, "Size: %d", header.size);
 
-	if ((out_len - index) != header.size)
+	if ((length - index) != header.size)
 	{
 		ESP_LOGD(TAG, "Invalid message size");
 		return ParsingInvalidFrame;
@@ -1100,22 +1460,23 @@ ParsingStatus tonexOne_ParsePacket(uint8_t *message, uint16_t inlength)
 
 	case PacketStateUpdate:
 	{
-		return tonexOne_ParseState(framedBuffer, out_len, index);
+		return tonexOne_ParseState(message, length, index);
 	}
 
 	case PacketStatePresetDetails:
 	{
-		return tonexOne_ParsePresetDetails(framedBuffer, out_len, index);
+		return tonexOne_ParsePresetDetails(message, length, index);
 	}
 
 	case PacketStatePresetDetailsFull:
 	{
-
-	} break;
+		return tonexOne_ParsePresetDetailsFull(message, length, index);
+	}
 
 	case PacketStateParamChanged:
 	{
 		ESP_LOGI(TAG, "Param change confirmation");
+		tonexData->message.header.type = PacketStateParamChanged;
 		return ParsingOk;
 	}
 
@@ -1130,8 +1491,6 @@ ParsingStatus tonexOne_ParsePacket(uint8_t *message, uint16_t inlength)
 
 esp_err_t tonexOne_SendSingleParameter(uint16_t index, float value)
 {
-    uint16_t framedLength;
-
     // NOTE: only supported in newer Pedal firmware that came with Editor support!
 
     // Build message                                         len LSB  len MSB
@@ -1146,19 +1505,12 @@ esp_err_t tonexOne_SendSingleParameter(uint16_t index, float value)
     // set param value
     memcpy((void*)&payload[6], (void*)&value, sizeof(value));
 
-    // build total message
-    memcpy((void*)txBuffer, (void*)message, sizeof(message));
-    memcpy((void*)&txBuffer[sizeof(message)], (void*)payload, sizeof(payload));
-
-    // add framing
-    framedLength = tonexOne_AddFraming(txBuffer, sizeof(message) + sizeof(payload), framedBuffer);
-
-    // debug
-    //ESP_LOG_BUFFER_HEXDUMP(TAG, FramedBuffer, framed_length, ESP_LOG_INFO);
+    TonexTxSegment segments[] = {
+        {message, sizeof(message)},
+        {payload, sizeof(payload)}};
 
     // send it
-	size_t sentBytes = SerialHost.write(framedBuffer, framedLength);
-	SerialHost.flush();
+	tonexOne_TransmitFramed(segments, 2, 0);
 	return 0;
    // return usb_tonex_one_transmit(FramedBuffer, framed_length);
 }
@@ -1197,28 +1549,30 @@ esp_err_t tonexOne_ModifyGlobal(uint16_t global_val, float value)
         case TONEX_GLOBAL_BPM:
         {
             // modify the BPM value in state packet
-            memcpy((void*)&tonexData->message.pedalData.stateData[tonexData->message.pedalData.stateDataLength - TONEX_STATE_OFFSET_END_BPM], (void*)&value, sizeof(float));
+            tonexOne_StateWrite(tonexData->message.pedalData.stateDataLength - TONEX_STATE_OFFSET_END_BPM, &value, sizeof(float));
             res = ESP_OK;
         } break;
 
         case TONEX_GLOBAL_INPUT_TRIM:
         {
             // modify the input trim value in state
-            memcpy((void*)&tonexData->message.pedalData.stateData[TONEX_STATE_OFFSET_START_INPUT_TRIM], (void*)&value, sizeof(float));
+            tonexOne_StateWrite(TONEX_STATE_OFFSET_START_INPUT_TRIM, &value, sizeof(float));
             res = ESP_OK;
         } break;
 
         case TONEX_GLOBAL_CABSIM_BYPASS:
         {
             // modify the cabsim bypass in state
-            tonexData->message.pedalData.stateData[TONEX_STATE_OFFSET_START_CAB_BYPASS] = (uint8_t)value;
+            uint8_t cabBypass = (uint8_t)value;
+            tonexOne_StateWrite(TONEX_STATE_OFFSET_START_CAB_BYPASS, &cabBypass, sizeof(cabBypass));
             res = ESP_OK;
         } break;
 
         case TONEX_GLOBAL_TEMPO_SOURCE:
         {
             // modify the tempo source value in state
-            tonexData->message.pedalData.stateData[tonexData->message.pedalData.stateDataLength - TONEX_STATE_OFFSET_END_TEMPO_SOURCE] = (uint8_t)value;
+            uint8_t tempoSource = (uint8_t)value;
+            tonexOne_StateWrite(tonexData->message.pedalData.stateDataLength - TONEX_STATE_OFFSET_END_TEMPO_SOURCE, &tempoSource, sizeof(tempoSource));
             res = ESP_OK;
         } break;
     }
@@ -1256,10 +1610,34 @@ ParsingStatus tonexOne_ParseState(uint8_t *unframed, uint16_t length, uint16_t i
 
 	tonexData->message.header.type = PacketStateUpdate;
 
+	if ((length - index) > MAX_STATE_DATA)
+	{
+		ESP_LOGE(TAG, "State data too large: %d", (int)(length - index));
+		return ParsingInvalidFrame;
+	}
+
+	// local edits not yet sent would be lost by the copy below, so carry them over
+	StateDelta* delta = &tonexData->stateDelta;
+	uint8_t pendingEdits[MAX_STATE_DATA];
+	uint8_t keepEdits = delta->dirty && ((length - index) == tonexData->message.pedalData.stateDataLength);
+	if (keepEdits)
+	{
+		memcpy((void*)pendingEdits, (void*)&tonexData->message.pedalData.stateData[delta->start], delta->end - delta->start);
+	}
+
 	tonexData->message.pedalData.stateDataLength = length - index;
 	memcpy((void*)tonexData->message.pedalData.stateData, (void*)&unframed[index], tonexData->message.pedalData.stateDataLength);
 	ESP_LOGI(TAG, "Saved Pedal StateData: %d", tonexData->message.pedalData.stateDataLength);
 
+	if (keepEdits)
+	{
+		memcpy((void*)&tonexData->message.pedalData.stateData[delta->start], (void*)pendingEdits, delta->end - delta->start);
+	}
+	else
+	{
+		delta->dirty = 0;
+	}
+
 	// save preset details
 	tonexData->message.slotAPreset = tonexData->message.pedalData.stateData[tonexData->message.pedalData.stateDataLength - TONEX_STATE_OFFSET_END_SLOT_A_PRESET];
 	tonexData->message.slotBPreset = tonexData->message.pedalData.stateData[tonexData->message.pedalData.stateDataLength - TONEX_STATE_OFFSET_END_SLOT_B_PRESET];
@@ -1286,138 +1664,274 @@ ParsingStatus tonexOne_ParseState(uint8_t *unframed, uint16_t length, uint16_t i
 	return ParsingOk;
 }
 
-uint16_t tonexOne_CalculateCRC(uint8_t *data, uint16_t length)
+// Writes a byte into the CDC message being built, escaping it if needed
+uint16_t tonexOne_PutByteWithStuffing(uint8_t byte)
+{
+	if (byte == FRAMING_BYTE || byte == FRAMING_ESCAPE_BYTE)
+	{
+		cdc_TransmitPut(tonexOneCdcSlot, FRAMING_ESCAPE_BYTE);
+		cdc_TransmitPut(tonexOneCdcSlot, byte ^ FRAMING_ESCAPE_XOR);
+		return 2;
+	}
+	cdc_TransmitPut(tonexOneCdcSlot, byte);
+	return 1;
+}
+
+// Frames the segments as one message straight into the CDC transmit queue, adding the opening
+// '7E' element, the CRC and the terminating element. With padToPacket set, the frame is padded
+// with a further flag and zeros up to the next 64-byte boundary
+esp_err_t tonexOne_TransmitFramed(const TonexTxSegment* segments, uint8_t count, uint8_t padToPacket)
 {
-	uint16_t crc = 0xFFFF;
+	uint16_t crc = CRC16_INIT;
+	uint16_t outlength = 0;
+
+	if (!cdc_TransmitBegin(tonexOneCdcSlot))
+	{
+		return ESP_FAIL;
+	}
+
+	// Start flag
+	cdc_TransmitPut(tonexOneCdcSlot, FRAMING_BYTE);
+	outlength++;
+
+	// add segment bytes
+	for (uint8_t segment = 0; segment < count; segment++)
+	{
+		for (uint16_t byte = 0; byte < segments[segment].length; byte++)
+		{
+			crc = crc16_Update(crc, segments[segment].data[byte]);
+			outlength += tonexOne_PutByteWithStuffing(segments[segment].data[byte]);
+		}
+	}
+
+	// add CRC
+	crc = ~crc;
+	outlength += tonexOne_PutByteWithStuffing(crc & 0xFF);
+	outlength += tonexOne_PutByteWithStuffing((crc >> 8) & 0xFF);
+
+	// End flag
+	cdc_TransmitPut(tonexOneCdcSlot, FRAMING_BYTE);
+	outlength++;
 
-	for (uint16_t loop = 0; loop < length; loop++)
+	if (padToPacket)
 	{
-		crc ^= data[loop];
+		uint8_t padding = 64 - (outlength % 64);
 
-		for (uint8_t i = 0; i < 8; ++i)
+		if (padding < 64)
 		{
-			if (crc & 1)
+			cdc_TransmitPut(tonexOneCdcSlot, FRAMING_BYTE);
+			for (uint8_t i = 0; i < padding - 2; i++)
 			{
-				crc = (crc >> 1) ^ 0x8408; // 0x8408 is the reversed polynomial x^16 + x^12 + x^5 + 1
-			}
-			else
-			{
-				crc = crc >> 1;
+				cdc_TransmitPut(tonexOneCdcSlot, 0x00);
 			}
 		}
+		cdc_TransmitPut(tonexOneCdcSlot, FRAMING_BYTE);
 	}
 
-	return ~crc;
+	if (cdc_TransmitEnd(tonexOneCdcSlot) == 0)
+	{
+		return ESP_FAIL;
+	}
+	return ESP_OK;
 }
 
-uint16_t tonexOne_AddByteWithStuffing(uint8_t *output, uint8_t byte)
+void tonexOne_RxResetFrame(RxFramingState state)
 {
-	uint16_t length = 0;
-
-	if (byte == FRAMING_BYTE || byte == 0x7D)
-	{
-		output[length] = 0x7D;
-		length++;
-		output[length] = byte ^ 0x20;
-		length++;
-	}
-	else
+	if (fullPreset.active)
 	{
-		output[length] = byte;
-		length++;
+		// the frame ended without being accepted
+		ESP_LOGW(TAG, "Full preset download aborted after %d bytes", (int)rxFramer.length);
+		fullPreset.active = 0;
 	}
-
-	return length;
+	rxFramer.state = state;
+	rxFramer.data = rxFramer.buffer;
+	rxFramer.capacity = RX_TEMP_BUFFER_SIZE;
+	rxFramer.length = 0;
+	rxFramer.crc = CRC16_INIT;
 }
 
-// Adds the opening '7E' element, along with terminating and CRC framing elements
-uint16_t tonexOne_AddFraming(uint8_t *input, uint16_t inlength, uint8_t *output)
+// Called once the start of a frame is buffered. Full preset details are moved into the
+// PSRAM store so the rest of the frame is written there directly
+void tonexOne_RxCheckFullPreset(void)
 {
-	uint16_t outlength = 0;
+	uint8_t index = 2;
 
-	// Start flag
-	output[outlength] = FRAMING_BYTE;
-	outlength++;
+	if ((fullPreset.data == NULL) || (rxFramer.data[0] != 0xB9) || (rxFramer.data[1] != 0x03))
+	{
+		return;
+	}
+	if (tonexOne_ParseValue(rxFramer.data, &index) != TONEX_TYPE_PRESET_DETAILS_FULL)
+	{
+		return;
+	}
+	fullPreset.total = tonexOne_ParseValue(rxFramer.data, &index);
+	tonexOne_ParseValue(rxFramer.data, &index);
 
-	// add input bytes
-	for (uint16_t byte = 0; byte < inlength; byte++)
+	if ((uint32_t)index + fullPreset.total + 2 > MAX_FULL_PRESET_DATA)
 	{
-		outlength += tonexOne_AddByteWithStuffing(&output[outlength], input[byte]);
+		ESP_LOGW(TAG, "Full preset too large: %d", (int)fullPreset.total);
+		return;
 	}
 
-	// add CRC
-	uint16_t crc = tonexOne_CalculateCRC(input, inlength);
-	outlength += tonexOne_AddByteWithStuffing(&output[outlength], crc & 0xFF);
-	outlength += tonexOne_AddByteWithStuffing(&output[outlength], (crc >> 8) & 0xFF);
+	memcpy((void*)fullPreset.data, (void*)rxFramer.data, rxFramer.length);
+	rxFramer.data = fullPreset.data;
+	rxFramer.capacity = MAX_FULL_PRESET_DATA;
 
-	// End flag
-	output[outlength] = FRAMING_BYTE;
-	outlength++;
+	fullPreset.active = 1;
+	fullPreset.valid = 0;
+	fullPreset.headerLength = index;
+	fullPreset.progressMark = 0;
+	memset((void*)&fullPreset.parser, 0, sizeof(fullPreset.parser));
+	fullPreset.parser.state = ParamParserMarker;
 
-	return outlength;
+	// catch the parser up with any payload bytes already received
+	for (uint16_t i = index; i < rxFramer.length; i++)
+	{
+		tonexOne_ParamParserByte(&fullPreset.parser, rxFramer.data[i]);
+	}
+	ESP_LOGI(TAG, "Receiving full preset details: %d bytes", (int)fullPreset.total);
 }
 
-ParsingStatus tonexOne_RemoveFraming(uint8_t *input, uint16_t inlength, uint8_t *output, uint16_t *outlength)
+void tonexOne_FullPresetByte(uint8_t byte)
 {
-	*outlength = 0;
-	uint8_t *output_ptr = output;
+	tonexOne_ParamParserByte(&fullPreset.parser, byte);
 
-	if ((inlength < 4) || (input[0] != 0x7E) || (input[inlength - 1] != 0x7E))
+	uint16_t received = rxFramer.length - fullPreset.headerLength;
+	if ((fullPresetProgressCallback != NULL) && (received < fullPreset.total) && (received >= fullPreset.progressMark + FULL_PRESET_PROGRESS_STEP))
 	{
-		ESP_LOGD(TAG, "Invalid Frame (1)");
-		return ParsingInvalidFrame;
+		fullPreset.progressMark = received;
+		fullPresetProgressCallback(received, fullPreset.total);
 	}
+}
 
-	for (uint16_t i = 1; i < inlength - 1; ++i)
+void tonexOne_ParamParserByte(PresetParamParser* parser, uint8_t byte)
+{
+	switch (parser->state)
 	{
-		if (input[i] == 0x7D)
+		case ParamParserMarker:
 		{
-			if ((i + 1) >= (inlength - 1))
+			parser->window = (parser->window << 8) | byte;
+			if (parser->window == PRESET_PARAM_START_MARKER)
 			{
-				ESP_LOGD(TAG, "Invalid Escape sequence");
-				return ParsingInvalidEscapeSequence;
+				parser->state = ParamParserPrefix;
 			}
+		} break;
 
-			*output_ptr = input[i + 1] ^ 0x20;
-			output_ptr++;
-			(*outlength)++;
-			++i;
-		}
-		else if (input[i] == 0x7E)
+		case ParamParserPrefix:
+		{
+			// params here are start marker of 0x88, followed by a 4-byte float
+			if (byte == PRESET_PARAM_VALUE_MARKER)
+			{
+				parser->valueBytes = 0;
+				parser->state = ParamParserValue;
+			}
+			else
+			{
+				ESP_LOGW(TAG, "Unexpected value during Param parse: %d, %d", (int)parser->paramIndex, (int)byte);
+				parser->state = ParamParserDone;
+			}
+		} break;
+
+		case ParamParserValue:
+		{
+			parser->value[parser->valueBytes] = byte;
+			parser->valueBytes++;
+			if (parser->valueBytes == sizeof(float))
+			{
+				memcpy((void*)&parser->values[parser->paramIndex], (void*)parser->value, sizeof(float));
+				parser->paramIndex++;
+				parser->state = (parser->paramIndex < TONEX_PARAM_LAST) ? ParamParserPrefix : ParamParserDone;
+			}
+		} break;
+
+		case ParamParserDone:
+		{
+		} break;
+	}
+}
+
+// Streaming de-framer. Returns 1 when the byte completed a valid frame
+uint8_t tonexOne_RxByte(uint8_t byte)
+{
+	uint8_t frameComplete = 0;
+
+	if (byte == FRAMING_BYTE)
+	{
+		// A flag both closes the current frame and opens the next one.
+		// Back to back flags (empty frames) are ignored
+		if (rxFramer.state == RxFramingData && rxFramer.length > 0)
 		{
-			break;
+			if (rxFramer.length < 2)
+			{
+				ESP_LOGD(TAG, "Invalid Frame (2)");
+			}
+			// Including the received CRC bytes in the running CRC leaves a fixed residual for a valid frame
+			else if (rxFramer.crc != CRC16_GOOD_RESIDUAL)
+			{
+				ESP_LOGD(TAG, "Crc mismatch: %X", (int)rxFramer.crc);
+			}
+			else
+			{
+				// strip the CRC and process the message
+				if (tonexOne_ProcessSingleMessage(rxFramer.data, rxFramer.length - 2) == ESP_OK)
+				{
+					frameComplete = 1;
+				}
+			}
 		}
-		else
+		else if (rxFramer.state == RxFramingEscape)
 		{
-			*output_ptr = input[i];
-			output_ptr++;
-			(*outlength)++;
+			ESP_LOGD(TAG, "Invalid Escape sequence");
 		}
+		tonexOne_RxResetFrame(RxFramingData);
+		return frameComplete;
 	}
 
-	if (*outlength < 2)
+	switch (rxFramer.state)
 	{
-		ESP_LOGD(TAG, "Invalid Frame (2)");
-		return ParsingInvalidFrame;
-	}
+		case RxFramingHunt:
+		case RxFramingDiscard:
+		{
+			// ignore everything until the next flag
+		} break;
 
-	// ESP_LOGI(TAG, "In:");
-	// ESP_LOGD_BUFFER_HEXDUMP(TAG, input, inlength, ESP_LOGD_INFO);
-	// ESP_LOGI(TAG, "Out:");
-	// ESP_LOGD_BUFFER_HEXDUMP(TAG, output, *outlength, ESP_LOGD_INFO);
+		case RxFramingData:
+		case RxFramingEscape:
+		{
+			if (rxFramer.state == RxFramingEscape)
+			{
+				byte ^= FRAMING_ESCAPE_XOR;
+				rxFramer.state = RxFramingData;
+			}
+			else if (byte == FRAMING_ESCAPE_BYTE)
+			{
+				rxFramer.state = RxFramingEscape;
+				break;
+			}
 
-	uint16_t received_crc = (output[(*outlength) - 1] << 8) | output[(*outlength) - 2];
-	(*outlength) -= 2;
+			if (rxFramer.length >= rxFramer.capacity)
+			{
+				ESP_LOGW(TAG, "RX frame overflow, discarding frame");
+				rxFramer.state = RxFramingDiscard;
+				break;
+			}
 
-	uint16_t calculated_crc = tonexOne_CalculateCRC(output, *outlength);
+			rxFramer.data[rxFramer.length] = byte;
+			rxFramer.length++;
+			rxFramer.crc = crc16_Update(rxFramer.crc, byte);
 
-	if (received_crc != calculated_crc)
-	{
-		ESP_LOGD(TAG, "Crc mismatch: %X, %X", (int)received_crc, (int)calculated_crc);
-		return ParsingCRCError;
+			if (fullPreset.active)
+			{
+				tonexOne_FullPresetByte(byte);
+			}
+			else if (rxFramer.length == TONEX_HEADER_MAX_LENGTH)
+			{
+				tonexOne_RxCheckFullPreset();
+			}
+		} break;
 	}
 
-	return ParsingOk;
+	return 0;
 }
 #endif
 #endif
\ No newline at end of file
@@ -141,28 +141,21 @@
 #define TONEX_ONE_GLOBAL_CABSIM_BYPASS_CC		125
 #define TONEX_ONE_GLOBAL_TEMPO_SOURCE_CC		126
 
-typedef enum 
-{
-   tonexOneSetPresetCommand,
-    tonexOneNextPresetCommand,
-    tonexOnePreviousPresetCommand,
-	tonexOneModifyParameterCommand
-} TonexOneCommand;
-
-typedef struct 
-{
-    uint8_t command;
-    uint32_t payload;
-    float payloadFloat;
-} TonexOneMessage;
-
 void tonexOne_Init();
-void tonexOne_InitQueue(QueueHandle_t comms_queue);
+void tonexOne_RegisterCdcDriver();
 void tonexOne_SendHello();
 uint8_t tonexOne_HandleReceivedData(char *rxData, uint16_t len);
 void tonexOne_Process();
 void tonexOne_NextPreset();
 void tonexOne_PreviousPreset();
 
+esp_err_t tonexOne_RequestFullPreset(uint8_t preset);
+const uint8_t* tonexOne_GetFullPreset(uint8_t* preset, uint16_t* length);
+void tonexOne_AssignFullPresetProgressCallback(void (*callback)(uint16_t received, uint16_t total));
+
+uint8_t tonexOne_GetCachedPresetName(uint8_t preset, char* name, uint8_t maxLength);
+uint8_t tonexOne_GetCachedPresetParameters(uint8_t preset, float* values, uint16_t count);
+void tonexOne_InvalidatePresetCache();
+
 #endif
 #endif // _TONEXONE_H_
\ No newline at end of file
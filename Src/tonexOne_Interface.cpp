@@ -1,103 +1,132 @@
 #ifdef USE_TONEX_ONE
 #include "tonexOne_Interface.h"
 #include "tonexOne.h"
+#include "tonexOne_Parameters.h"
 #include "esp_log.h"
 
-static QueueHandle_t usb_input_queue;
+#define PENDING_WORDS		((TONEX_GLOBAL_LAST + 31) / 32)
+
+// Commands waiting for the Tonex One task. Repeated writes to the same parameter only keep
+// the latest value, and a preset change replaces any preset change still waiting
+typedef struct
+{
+	uint32_t dirty[PENDING_WORDS];
+	float values[TONEX_GLOBAL_LAST];
+	int16_t presetTarget;			// absolute preset, TONEX_ONE_PRESET_RELATIVE if none
+	int16_t presetOffset;			// accumulated next/previous steps
+	uint8_t presetPending;
+} TonexOnePendingCommands;
+
+static TonexOnePendingCommands pending;
+static portMUX_TYPE pendingMux = portMUX_INITIALIZER_UNLOCKED;
 
 const char *TONEX_INTERFACE_TAG = "TonexOne Interface";
 
+void tonexOne_InterfaceClearPresetParameters();
+
 void tonexOne_InterfaceInit()
 {
-	// create queue for commands from other threads
-	usb_input_queue = xQueueCreate(10, sizeof(TonexOneMessage));
-	if (usb_input_queue == NULL)
-	{
-		ESP_LOGE(TONEX_INTERFACE_TAG, "Failed to create usb input queue!");
-	}
-	tonexOne_InitQueue(usb_input_queue);
+	portENTER_CRITICAL(&pendingMux);
+	memset((void*)&pending, 0, sizeof(pending));
+	pending.presetTarget = TONEX_ONE_PRESET_RELATIVE;
+	portEXIT_CRITICAL(&pendingMux);
 }
 
 void tonexOne_SendGoToPreset(uint8_t presetNum)
 {
+	if (presetNum >= MAX_TONEX_ONE_PRESETS)
+	{
+		ESP_LOGW(TONEX_INTERFACE_TAG, "Invalid preset %d", (int)presetNum);
+		return;
+	}
+	portENTER_CRITICAL(&pendingMux);
+	pending.presetTarget = presetNum;
+	pending.presetOffset = 0;
+	pending.presetPending = 1;
+	tonexOne_InterfaceClearPresetParameters();
+	portEXIT_CRITICAL(&pendingMux);
 }
 
 void tonexOne_SendNextPreset()
 {
-	TonexOneMessage message;
-	/*
-	if (usb_input_queue == NULL)
-	{
-		ESP_LOGE(TONEX_INTERFACE_TAG, "usb_next_preset queue null");
-	}
-	else
-	{
-		message.command = tonexOneNextPresetCommand;
-
-		// send to queue
-		if (xQueueSend(usb_input_queue, (void *)&message, 0) != pdPASS)
-		{
-			ESP_LOGE(TONEX_INTERFACE_TAG, "usb_next_preset queue send failed!");
-		}
-		else
-		{
-			ESP_LOGI(TONEX_INTERFACE_TAG, "usb_next_preset queue send success!");
-		}
-	}
-
-	*/
-	tonexOne_NextPreset();
+	portENTER_CRITICAL(&pendingMux);
+	pending.presetOffset++;
+	pending.presetPending = 1;
+	tonexOne_InterfaceClearPresetParameters();
+	portEXIT_CRITICAL(&pendingMux);
 }
 
 void tonexOne_SendPreviousPreset()
 {
-	TonexOneMessage message;
-	/*
-	if (usb_input_queue == NULL)
-	{
-		ESP_LOGE(TONEX_INTERFACE_TAG, "usb_previous_preset queue null");
-	}
-	else
-	{
-		message.command = tonexOnePreviousPresetCommand;
+	portENTER_CRITICAL(&pendingMux);
+	pending.presetOffset--;
+	pending.presetPending = 1;
+	tonexOne_InterfaceClearPresetParameters();
+	portEXIT_CRITICAL(&pendingMux);
+}
 
-		// send to queue
-		if (xQueueSend(usb_input_queue, (void *)&message, 0) != pdPASS)
-		{
-			ESP_LOGE(TONEX_INTERFACE_TAG, "usb_previous_preset queue send failed!");
-		}
-		else
-		{
-			ESP_LOGI(TONEX_INTERFACE_TAG, "usb_previous_preset queue send success!");
-		}
+void tonexOne_SendParameter(uint16_t parameter, float value)
+{
+	if (parameter >= TONEX_GLOBAL_LAST || parameter == TONEX_PARAM_LAST)
+	{
+		ESP_LOGW(TONEX_INTERFACE_TAG, "Attempt to modify unknown param %d", (int)parameter);
+		return;
 	}
-		*/
-	tonexOne_PreviousPreset();
+	portENTER_CRITICAL(&pendingMux);
+	pending.values[parameter] = value;
+	pending.dirty[parameter / 32] |= (1UL << (parameter % 32));
+	portEXIT_CRITICAL(&pendingMux);
 }
 
-void tonexOne_SendParameter(uint16_t parameter, float value)
+// Takes the pending preset change, if any. A target of TONEX_ONE_PRESET_RELATIVE means the
+// offset applies to the preset currently loaded
+uint8_t tonexOne_InterfaceTakePreset(int16_t* target, int16_t* offset)
 {
-	TonexOneMessage message;
+	uint8_t result = 0;
 
-	if (usb_input_queue == NULL)
+	portENTER_CRITICAL(&pendingMux);
+	if (pending.presetPending)
 	{
-		ESP_LOGE(TONEX_INTERFACE_TAG, "usb queue null");
+		*target = pending.presetTarget;
+		*offset = pending.presetOffset;
+		pending.presetTarget = TONEX_ONE_PRESET_RELATIVE;
+		pending.presetOffset = 0;
+		pending.presetPending = 0;
+		result = 1;
 	}
-	else
-	{
-		message.command = tonexOneModifyParameterCommand;
-		message.payload = parameter;
-		message.payloadFloat = value;
+	portEXIT_CRITICAL(&pendingMux);
+	return result;
+}
 
-		// send to queue
-		if (xQueueSend(usb_input_queue, (void *)&message, 0) != pdPASS)
-		{
-			ESP_LOGE(TONEX_INTERFACE_TAG, "Send parameter command to queue failed!");
-		}
-		else
+// Takes the lowest numbered parameter with a pending write
+uint8_t tonexOne_InterfaceTakeParameter(uint16_t* parameter, float* value)
+{
+	uint8_t result = 0;
+
+	portENTER_CRITICAL(&pendingMux);
+	for (uint16_t word = 0; word < PENDING_WORDS; word++)
+	{
+		if (pending.dirty[word] != 0)
 		{
-			ESP_LOGI(TONEX_INTERFACE_TAG, "Send parameter command to queue success!");
+			uint16_t bit = __builtin_ctz(pending.dirty[word]);
+			pending.dirty[word] &= ~(1UL << bit);
+			*parameter = (word * 32) + bit;
+			*value = pending.values[*parameter];
+			result = 1;
+			break;
 		}
 	}
+	portEXIT_CRITICAL(&pendingMux);
+	return result;
+}
+
+// A new preset loads its own parameters, so queued writes for the old one are dropped.
+// Globals are kept. Must be called with pendingMux held
+void tonexOne_InterfaceClearPresetParameters()
+{
+	for (uint16_t param = 0; param < TONEX_PARAM_LAST; param++)
+	{
+		pending.dirty[param / 32] &= ~(1UL << (param % 32));
+	}
 }
 #endif
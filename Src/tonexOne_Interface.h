@@ -3,11 +3,17 @@
 #ifdef USE_TONEX_ONE
 #include "stdint.h"
 
+#define TONEX_ONE_PRESET_RELATIVE		-1
+
 void tonexOne_InterfaceInit();
 void tonexOne_SendGoToPreset(uint8_t presetNum);
 void tonexOne_SendPreviousPreset();
 void tonexOne_SendNextPreset();
 void tonexOne_SendParameter(uint16_t parameter, float value);
 
+// Used by the Tonex One task to drain pending commands
+uint8_t tonexOne_InterfaceTakePreset(int16_t* target, int16_t* offset);
+uint8_t tonexOne_InterfaceTakeParameter(uint16_t* parameter, float* value);
+
 #endif
 #endif // TONEXONE_INTERFACE_H_
\ No newline at end of file
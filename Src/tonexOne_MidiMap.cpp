@@ -0,0 +1,297 @@
+#ifdef USE_TONEX_ONE
+#include "tonexOne_MidiMap.h"
+#include "tonexOne.h"
+#include "tonexOne_Interface.h"
+#include "tonexOne_Parameters.h"
+#include "esp_log.h"
+
+#define MIDI_CC_COUNT		128
+#define MIDI_CC_MAX_VALUE	127.0f
+#define MIDI_CC_SWITCH_ON	64
+
+static const char *TAG = "TonexOne MidiMap";
+
+typedef enum
+{
+	CcCurveNone,			// CC not used by the pedal
+	CcCurveLinear,			// 0-127 spread across the parameter's Min/Max
+	CcCurveSwitch,			// 0-63 = Min, 64-127 = Max
+	CcCurveStepped,			// linear, rounded to whole values (model/type selects)
+	CcCurvePresetDown,
+	CcCurvePresetUp,
+	CcCurveGoToPreset
+} TonexCcCurve;
+
+typedef struct
+{
+	uint16_t param;
+	uint8_t curve;
+} TonexCcMapping;
+
+typedef struct
+{
+	uint8_t cc;
+	TonexCcMapping mapping;
+} TonexCcSource;
+
+// Source list, in the same order as the CC defines in tonexOne.h
+static constexpr TonexCcSource tonexCcSource[] =
+{
+	// Delay
+	{TONEX_ONE_DELAY_POSITION,				{TONEX_PARAM_DELAY_POST,					CcCurveSwitch}},
+	{TONEX_ONE_DELAY_POWER_CC,				{TONEX_PARAM_DELAY_ENABLE,					CcCurveSwitch}},
+	{TONEX_ONE_DELAY_TYPE_CC,				{TONEX_PARAM_DELAY_MODEL,					CcCurveStepped}},
+	{TONEX_ONE_DELAY_DIGITAL_SYNC_CC,		{TONEX_PARAM_DELAY_DIGITAL_SYNC,			CcCurveSwitch}},
+	{TONEX_ONE_DELAY_DIGITAL_TIME_CC,		{TONEX_PARAM_DELAY_DIGITAL_TIME,			CcCurveLinear}},
+	{TONEX_ONE_DELAY_DIGITAL_FEEDBACK_CC,	{TONEX_PARAM_DELAY_DIGITAL_FEEDBACK,		CcCurveLinear}},
+	{TONEX_ONE_DELAY_DIGITAL_MODE_CC,		{TONEX_PARAM_DELAY_DIGITAL_MODE,			CcCurveSwitch}},
+	{TONEX_ONE_DELAY_DIGITAL_MIX_CC,		{TONEX_PARAM_DELAY_DIGITAL_MIX,				CcCurveLinear}},
+	{TONEX_ONE_DELAY_TAPE_SYNC_CC,			{TONEX_PARAM_DELAY_TAPE_SYNC,				CcCurveSwitch}},
+	{TONEX_ONE_DELAY_TAPE_TIME_CC,			{TONEX_PARAM_DELAY_TAPE_TIME,				CcCurveLinear}},
+	{TONEX_ONE_DELAY_TAPE_FEEDBACK_CC,		{TONEX_PARAM_DELAY_TAPE_FEEDBACK,			CcCurveLinear}},
+	{TONEX_ONE_DELAY_TAPE_MODE_CC,			{TONEX_PARAM_DELAY_TAPE_MODE,				CcCurveSwitch}},
+	{TONEX_ONE_DELAY_TAPE_MIX_CC,			{TONEX_PARAM_DELAY_TAPE_MIX,				CcCurveLinear}},
+
+	// Bypass has no parameter of its own
+	{TONEX_ONE_BYPASS_CC,					{TONEX_UNKNOWN,								CcCurveNone}},
+
+	// Noise Gate
+	{TONEX_ONE_COMP_POSITION,				{TONEX_PARAM_NOISE_GATE_POST,				CcCurveSwitch}},
+	{TONEX_ONE_GATE_POWER_CC,				{TONEX_PARAM_NOISE_GATE_ENABLE,				CcCurveSwitch}},
+	{TONEX_ONE_GATE_THRESHOLD_CC,			{TONEX_PARAM_NOISE_GATE_THRESHOLD,			CcCurveLinear}},
+	{TONEX_ONE_GATE_RELEASE_CC,				{TONEX_PARAM_NOISE_GATE_RELEASE,			CcCurveLinear}},
+	{TONEX_ONE_GATE_DEPTH_CC,				{TONEX_PARAM_NOISE_GATE_DEPTH,				CcCurveLinear}},
+
+	// Compressor
+	{TONEX_ONE_COMP_POWER_CC,				{TONEX_PARAM_COMP_ENABLE,					CcCurveSwitch}},
+	{TONEX_ONE_COMP_THRESHOLD_CC,			{TONEX_PARAM_COMP_THRESHOLD,				CcCurveLinear}},
+	{TONEX_ONE_COMP_GAIN_CC,				{TONEX_PARAM_COMP_MAKE_UP,					CcCurveLinear}},
+	{TONEX_ONE_COMP_ATTACK_CC,				{TONEX_PARAM_COMP_ATTACK,					CcCurveLinear}},
+	{TONEX_ONE_COMP_POSITION_CC,			{TONEX_PARAM_COMP_POST,						CcCurveSwitch}},
+
+	// EQ
+	{TONEX_ONE_EQ_BASS_CC,					{TONEX_PARAM_EQ_BASS,						CcCurveLinear}},
+	{TONEX_ONE_EQ_BASS_FREQ_CC,				{TONEX_PARAM_EQ_BASS_FREQ,					CcCurveLinear}},
+	{TONEX_ONE_EQ_MID_CC,					{TONEX_PARAM_EQ_MID,						CcCurveLinear}},
+	{TONEX_ONE_EQ_MIDQ_CC,					{TONEX_PARAM_EQ_MIDQ,						CcCurveLinear}},
+	{TONEX_ONE_EQ_MID_FREQ_CC,				{TONEX_PARAM_EQ_MID_FREQ,					CcCurveLinear}},
+	{TONEX_ONE_EQ_TREBLE_CC,				{TONEX_PARAM_EQ_TREBLE,						CcCurveLinear}},
+	{TONEX_ONE_EQ_TREBLE_FREQ_CC,			{TONEX_PARAM_EQ_TREBLE_FREQ,				CcCurveLinear}},
+	{TONEX_ONE_EQ_POST_CC,					{TONEX_PARAM_EQ_POST,						CcCurveSwitch}},
+
+	// Modulation
+	{TONEX_ONE_MOD_POSITION_CC,				{TONEX_PARAM_MODULATION_POST,				CcCurveSwitch}},
+	{TONEX_ONE_MOD_POWER_CC,				{TONEX_PARAM_MODULATION_ENABLE,				CcCurveSwitch}},
+	{TONEX_ONE_MOD_TYPE_CC,					{TONEX_PARAM_MODULATION_MODEL,				CcCurveStepped}},
+	{TONEX_ONE_MOD_CHORUS_SYNC_CC,			{TONEX_PARAM_MODULATION_CHORUS_SYNC,		CcCurveSwitch}},
+	{TONEX_ONE_MOD_CHORUS_RATE_CC,			{TONEX_PARAM_MODULATION_CHORUS_RATE,		CcCurveLinear}},
+	{TONEX_ONE_MOD_CHORUS_DEPTH_CC,			{TONEX_PARAM_MODULATION_CHORUS_DEPTH,		CcCurveLinear}},
+	{TONEX_ONE_MOD_CHORUS_LEVEL_CC,			{TONEX_PARAM_MODULATION_CHORUS_LEVEL,		CcCurveLinear}},
+	{TONEX_ONE_MOD_TREM_SYNC_CC,			{TONEX_PARAM_MODULATION_TREMOLO_SYNC,		CcCurveSwitch}},
+	{TONEX_ONE_MOD_TREM_RATE_CC,			{TONEX_PARAM_MODULATION_TREMOLO_RATE,		CcCurveLinear}},
+	{TONEX_ONE_MOD_TREM_SHAPE_CC,			{TONEX_PARAM_MODULATION_TREMOLO_SHAPE,		CcCurveLinear}},
+	{TONEX_ONE_MOD_TREM_SPREAD_CC,			{TONEX_PARAM_MODULATION_TREMOLO_SPREAD,		CcCurveLinear}},
+	{TONEX_ONE_MOD_TREM_LEVEL_CC,			{TONEX_PARAM_MODULATION_TREMOLO_LEVEL,		CcCurveLinear}},
+	{TONEX_ONE_MOD_PHASER_SYNC_CC,			{TONEX_PARAM_MODULATION_PHASER_SYNC,		CcCurveSwitch}},
+	{TONEX_ONE_MOD_PHASER_RATE_CC,			{TONEX_PARAM_MODULATION_PHASER_RATE,		CcCurveLinear}},
+	{TONEX_ONE_MOD_PHASER_DEPTH_CC,			{TONEX_PARAM_MODULATION_PHASER_DEPTH,		CcCurveLinear}},
+	{TONEX_ONE_MOD_PHASER_LEVEL_CC,			{TONEX_PARAM_MODULATION_PHASER_LEVEL,		CcCurveLinear}},
+	{TONEX_ONE_MOD_FLANGER_SYNC_CC,			{TONEX_PARAM_MODULATION_FLANGER_SYNC,		CcCurveSwitch}},
+	{TONEX_ONE_MOD_FLANGER_RATE_CC,			{TONEX_PARAM_MODULATION_FLANGER_RATE,		CcCurveLinear}},
+	{TONEX_ONE_MOD_FLANGER_DEPTH_CC,		{TONEX_PARAM_MODULATION_FLANGER_DEPTH,		CcCurveLinear}},
+	{TONEX_ONE_MOD_FLANGER_FEEDBACK_CC,		{TONEX_PARAM_MODULATION_FLANGER_FEEDBACK,	CcCurveLinear}},
+	{TONEX_ONE_MOD_FLANGER_LEVEL_CC,		{TONEX_PARAM_MODULATION_FLANGER_LEVEL,		CcCurveLinear}},
+	{TONEX_ONE_MOD_ROTARY_SYNC_CC,			{TONEX_PARAM_MODULATION_ROTARY_SYNC,		CcCurveSwitch}},
+	{TONEX_ONE_MOD_ROTARY_SPEED_CC,			{TONEX_PARAM_MODULATION_ROTARY_SPEED,		CcCurveLinear}},
+	{TONEX_ONE_MOD_ROTARY_RADIUS_CC,		{TONEX_PARAM_MODULATION_ROTARY_RADIUS,		CcCurveLinear}},
+	{TONEX_ONE_MOD_ROTARY_SPREAD_CC,		{TONEX_PARAM_MODULATION_ROTARY_SPREAD,		CcCurveLinear}},
+	{TONEX_ONE_MOD_ROTARY_LEVEL_CC,			{TONEX_PARAM_MODULATION_ROTARY_LEVEL,		CcCurveLinear}},
+
+	// Reverb
+	{TONEX_ONE_REVEB_SPRING1_TIME_CC,		{TONEX_PARAM_REVERB_SPRING1_TIME,			CcCurveLinear}},
+	{TONEX_ONE_REVEB_SPRING1_PREDELAY_CC,	{TONEX_PARAM_REVERB_SPRING1_PREDELAY,		CcCurveLinear}},
+	{TONEX_ONE_REVEB_SPRING1_COLOR_CC,		{TONEX_PARAM_REVERB_SPRING1_COLOR,			CcCurveLinear}},
+	{TONEX_ONE_REVEB_SPRING1_MIX_CC,		{TONEX_PARAM_REVERB_SPRING1_MIX,			CcCurveLinear}},
+	{TONEX_ONE_REVEB_SPRING2_TIME_CC,		{TONEX_PARAM_REVERB_SPRING2_TIME,			CcCurveLinear}},
+	{TONEX_ONE_REVEB_SPRING2_PREDELAY_CC,	{TONEX_PARAM_REVERB_SPRING2_PREDELAY,		CcCurveLinear}},
+	{TONEX_ONE_REVEB_SPRING2_COLOR_CC,		{TONEX_PARAM_REVERB_SPRING2_COLOR,			CcCurveLinear}},
+	{TONEX_ONE_REVEB_SPRING2_MIX_CC,		{TONEX_PARAM_REVERB_SPRING2_MIX,			CcCurveLinear}},
+	{TONEX_ONE_REVEB_SPRING3_TIME_CC,		{TONEX_PARAM_REVERB_SPRING3_TIME,			CcCurveLinear}},
+	{TONEX_ONE_REVEB_SPRING3_PREDELAY_CC,	{TONEX_PARAM_REVERB_SPRING3_PREDELAY,		CcCurveLinear}},
+	{TONEX_ONE_REVEB_SPRING3_COLOR_CC,		{TONEX_PARAM_REVERB_SPRING3_COLOR,			CcCurveLinear}},
+	{TONEX_ONE_REVEB_SPRING3_MIX_CC,		{TONEX_PARAM_REVERB_SPRING3_MIX,			CcCurveLinear}},
+	{TONEX_ONE_REVER_ROOM_TIME_CC,			{TONEX_PARAM_REVERB_ROOM_TIME,				CcCurveLinear}},
+	{TONEX_ONE_REVER_ROOM_PREDELAY_CC,		{TONEX_PARAM_REVERB_ROOM_PREDELAY,			CcCurveLinear}},
+	{TONEX_ONE_REVER_ROOM_COLOR_CC,			{TONEX_PARAM_REVERB_ROOM_COLOR,				CcCurveLinear}},
+	{TONEX_ONE_REVER_ROOM_MIX_CC,			{TONEX_PARAM_REVERB_ROOM_MIX,				CcCurveLinear}},
+	{TONEX_ONE_REVEB_POWER_CC,				{TONEX_PARAM_REVERB_ENABLE,					CcCurveSwitch}},
+	{TONEX_ONE_REVEB_PLATE_TIME_CC,			{TONEX_PARAM_REVERB_PLATE_TIME,				CcCurveLinear}},
+	{TONEX_ONE_REVEB_PLATE_PREDELAY_CC,		{TONEX_PARAM_REVERB_PLATE_PREDELAY,			CcCurveLinear}},
+	{TONEX_ONE_REVEB_PLATE_COLOR_CC,		{TONEX_PARAM_REVERB_PLATE_COLOR,			CcCurveLinear}},
+	{TONEX_ONE_REVEB_PLATE_MIX_CC,			{TONEX_PARAM_REVERB_PLATE_MIX,				CcCurveLinear}},
+	{TONEX_ONE_REVEB_SPRING4_TIME_CC,		{TONEX_PARAM_REVERB_SPRING4_TIME,			CcCurveLinear}},
+	{TONEX_ONE_REVEB_SPRING4_PREDELAY_CC,	{TONEX_PARAM_REVERB_SPRING4_PREDELAY,		CcCurveLinear}},
+	{TONEX_ONE_REVEB_SPRING4_COLOR_CC,		{TONEX_PARAM_REVERB_SPRING4_COLOR,			CcCurveLinear}},
+	{TONEX_ONE_REVEB_SPRING4_MIX_CC,		{TONEX_PARAM_REVERB_SPRING4_MIX,			CcCurveLinear}},
+	{TONEX_ONE_REVEB_POSITION_CC,			{TONEX_PARAM_REVERB_POSITION,				CcCurveSwitch}},
+	{TONEX_ONE_REVERB_TYPE_CC,				{TONEX_PARAM_REVERB_MODEL,					CcCurveStepped}},
+
+	// Presets
+	{TONEX_ONE_PRESET_DOWN_CC,				{TONEX_UNKNOWN,								CcCurvePresetDown}},
+	{TONEX_ONE_PRESET_UP_CC,				{TONEX_UNKNOWN,								CcCurvePresetUp}},
+	{TONEX_ONE_GO_TO_PRESET_CC,				{TONEX_UNKNOWN,								CcCurveGoToPreset}},
+
+	// Amplifier Model
+	{TONEX_ONE_MODEL_CABINET_TYPE_CC,		{TONEX_PARAM_CABINET_TYPE,					CcCurveStepped}},
+	{TONEX_ONE_MODEL_ENABLE_CC,				{TONEX_PARAM_MODEL_AMP_ENABLE,				CcCurveSwitch}},
+	{TONEX_ONE_MODEL_GAIN_CC,				{TONEX_PARAM_MODEL_GAIN,					CcCurveLinear}},
+	{TONEX_ONE_MODEL_VOLUME_CC,				{TONEX_PARAM_MODEL_VOLUME,					CcCurveLinear}},
+	{TONEX_ONE_MODEL_MIX_CC,				{TONEX_PARAM_MODEX_MIX,						CcCurveLinear}},
+
+	// Virtual IR Cab
+	{TONEX_ONE_VIR_CAB_PRESENCE_CC,			{TONEX_PARAM_MODEL_PRESENCE,				CcCurveLinear}},
+	{TONEX_ONE_VIR_CAB_DEPTH_CC,			{TONEX_PARAM_MODEL_DEPTH,					CcCurveLinear}},
+	{TONEX_ONE_VIR_CAB_RESO_CC,				{TONEX_PARAM_VIR_RESO,						CcCurveLinear}},
+	{TONEX_ONE_VIR_CAB_M1_CC,				{TONEX_PARAM_VIR_MIC_1,						CcCurveStepped}},
+	{TONEX_ONE_VIR_CAB_M1_X_CC,				{TONEX_PARAM_VIR_MIC_1_X,					CcCurveLinear}},
+	{TONEX_ONE_VIR_CAB_M1_Z_CC,				{TONEX_PARAM_VIR_MIC_1_Z,					CcCurveLinear}},
+	{TONEX_ONE_VIR_CAB_M2_CC,				{TONEX_PARAM_VIR_MIC_2,						CcCurveStepped}},
+	{TONEX_ONE_VIR_CAB_M2_X_CC,				{TONEX_PARAM_VIR_MIC_2_X,					CcCurveLinear}},
+	{TONEX_ONE_VIR_CAB_M2_Z_CC,				{TONEX_PARAM_VIR_MIC_2_Z,					CcCurveLinear}},
+	{TONEX_ONE_VIR_CAB_BLEND_CC,			{TONEX_PARAM_VIR_BLEND,						CcCurveLinear}},
+
+	// Globals
+	{TONEX_ONE_GLOBAL_BPM_CC,				{TONEX_GLOBAL_BPM,							CcCurveLinear}},
+	{TONEX_ONE_GLOBAL_INPUT_TRIM_CC,		{TONEX_GLOBAL_INPUT_TRIM,					CcCurveLinear}},
+	{TONEX_ONE_GLOBAL_CABSIM_BYPASS_CC,		{TONEX_GLOBAL_CABSIM_BYPASS,				CcCurveSwitch}},
+	{TONEX_ONE_GLOBAL_TEMPO_SOURCE_CC,		{TONEX_GLOBAL_TEMPO_SOURCE,					CcCurveSwitch}},
+};
+
+#define TONEX_CC_SOURCE_COUNT	(sizeof(tonexCcSource) / sizeof(tonexCcSource[0]))
+
+// Compile time search of the source list, used to expand it into a table indexed by CC number
+constexpr TonexCcMapping tonexOne_FindCc(uint8_t cc, uint16_t index)
+{
+	return (index >= TONEX_CC_SOURCE_COUNT) ? TonexCcMapping{TONEX_UNKNOWN, CcCurveNone}
+		: (tonexCcSource[index].cc == cc) ? tonexCcSource[index].mapping
+		: tonexOne_FindCc(cc, index + 1);
+}
+
+constexpr uint16_t tonexOne_FirstCcIndex(uint8_t cc, uint16_t index)
+{
+	return (index >= TONEX_CC_SOURCE_COUNT || tonexCcSource[index].cc == cc) ? index : tonexOne_FirstCcIndex(cc, index + 1);
+}
+
+constexpr uint8_t tonexOne_CcIsUnique(uint16_t index)
+{
+	return (index >= TONEX_CC_SOURCE_COUNT) ? 1
+		: (tonexOne_FirstCcIndex(tonexCcSource[index].cc, 0) != index) ? 0
+		: tonexOne_CcIsUnique(index + 1);
+}
+
+static_assert(tonexOne_CcIsUnique(0), "Tonex One CC assigned twice");
+
+#define CC_ROW(n)		tonexOne_FindCc((n), 0)
+#define CC_ROW8(n)		CC_ROW(n), CC_ROW(n + 1), CC_ROW(n + 2), CC_ROW(n + 3), CC_ROW(n + 4), CC_ROW(n + 5), CC_ROW(n + 6), CC_ROW(n + 7)
+#define CC_ROW32(n)		CC_ROW8(n), CC_ROW8(n + 8), CC_ROW8(n + 16), CC_ROW8(n + 24)
+
+static constexpr TonexCcMapping tonexCcMap[MIDI_CC_COUNT] =
+{
+	CC_ROW32(0), CC_ROW32(32), CC_ROW32(64), CC_ROW32(96)
+};
+
+static uint8_t midiChannel = TONEX_ONE_DEFAULT_MIDI_CHANNEL;
+
+//---------------------- Public Functions ----------------------//
+void tonexOne_SetMidiChannel(uint8_t channel)
+{
+	midiChannel = channel;
+}
+
+uint8_t tonexOne_GetMidiChannel()
+{
+	return midiChannel;
+}
+
+// Returns 1 if the CC was handled as a Tonex One command
+uint8_t tonexOne_HandleMidiControlChange(uint8_t channel, uint8_t number, uint8_t value)
+{
+	float min;
+	float max;
+	float scaled;
+
+	if (channel != midiChannel || number >= MIDI_CC_COUNT)
+	{
+		return 0;
+	}
+
+	const TonexCcMapping mapping = tonexCcMap[number];
+	switch (mapping.curve)
+	{
+		case CcCurveNone:
+		{
+			return 0;
+		}
+
+		case CcCurvePresetDown:
+		{
+			// act on press only, momentary switches send 0 on release
+			if (value > 0)
+			{
+				tonexOne_SendPreviousPreset();
+			}
+			return 1;
+		}
+
+		case CcCurvePresetUp:
+		{
+			if (value > 0)
+			{
+				tonexOne_SendNextPreset();
+			}
+			return 1;
+		}
+
+		case CcCurveGoToPreset:
+		{
+			if (value < MAX_TONEX_ONE_PRESETS)
+			{
+				tonexOne_SendGoToPreset(value);
+			}
+			return 1;
+		}
+
+		default:
+			break;
+	}
+
+	// a single lock for the range, the result then always lies within it
+	if (tonex_params_get_min_max(mapping.param, &min, &max) != ESP_OK)
+	{
+		ESP_LOGW(TAG, "No range for param %d", (int)mapping.param);
+		return 0;
+	}
+
+	switch (mapping.curve)
+	{
+		case CcCurveSwitch:
+		{
+			scaled = (value >= MIDI_CC_SWITCH_ON) ? max : min;
+		} break;
+
+		case CcCurveStepped:
+		{
+			scaled = (float)(int32_t)(min + ((max - min) * value / MIDI_CC_MAX_VALUE) + 0.5f);
+		} break;
+
+		case CcCurveLinear:
+		default:
+		{
+			scaled = min + ((max - min) * value / MIDI_CC_MAX_VALUE);
+		} break;
+	}
+
+	tonexOne_SendParameter(mapping.param, scaled);
+	return 1;
+}
+#endif
@@ -0,0 +1,11 @@
+#ifndef TONEXONE_MIDIMAP_H_
+#define TONEXONE_MIDIMAP_H_
+#ifdef USE_TONEX_ONE
+#include "stdint.h"
+
+void tonexOne_SetMidiChannel(uint8_t channel);
+uint8_t tonexOne_GetMidiChannel();
+uint8_t tonexOne_HandleMidiControlChange(uint8_t channel, uint8_t number, uint8_t value);
+
+#endif
+#endif // TONEXONE_MIDIMAP_H_
@@ -6,34 +6,52 @@
 #include "usb_helpers.h"
 #include "usbh_cdc_handling.h"
 #include "tonexone.h"
+#include "esp32_manager.h"
 
 // Language ID: English
 #define LANGUAGE_ID 0x0409
+#define USBH_DESC_SCRATCH_SIZE 1024
+#define USBH_EVENT_TIMEOUT_MS 20
 
+static const char *TAG = "USBH";
 
-dev_info_t dev_info[CFG_TUH_DEVICE_MAX] = {0};
+dev_info_t dev_info[USBH_MAX_DEVICES] = {0};
 
-Adafruit_USBH_Host USBHost(new SPIClass(USBH_SPI), USBH_SPI_SCK_PIN, USBH_SPI_MOSI_PIN, USBH_SPI_MISO_PIN, USBH_CS_PIN, USBH_INT_PIN);
+// Configuration descriptors are read one device at a time into this buffer
+static uint8_t descScratch[USBH_DESC_SCRATCH_SIZE];
+static uint8_t descScratchOwner = 0;		// device address using descScratch, 0 if free
+
+Adafruit_USBH_Host USBHost(new SPIClass(USBH_SPI), USBH_SPI_SCK_PIN, USBH_SPI_MOSI_PIN, USBH_SPI_MISO_PIN, USBH_CS_PIN, USBH_INT_PIN, USBH_SPI_CLOCK);
+
+static UsbhStats usbhStats;
+static uint32_t usbhStatsStart = 0;		// ms
+static portMUX_TYPE usbhStatsMux = portMUX_INITIALIZER_UNLOCKED;
 
 
 //---------------------- Private Function Prototypes ----------------------//
-void parse_config_descriptor(uint8_t dev_addr, tusb_desc_configuration_t const *desc_cfg);
+void parse_config_descriptor(uint8_t dev_addr, tusb_desc_configuration_t const *desc_cfg, uint16_t length);
 uint16_t count_interface_total_len(tusb_desc_interface_t const *desc_itf, uint8_t itf_count, uint16_t max_len);
 void print_lsusb(void);
+void usbh_EnumComplete(tuh_xfer_t* xfer);
+void usbh_EnumNextConfig(void);
+void usbh_EnumNextString(uint8_t daddr, dev_info_t* dev);
 
 
 // FreeRTOS Tasks
+// The MAX3421E INT pin interrupt is serviced by the TinyUSB port, which posts the resulting
+// events to the host stack queue. The task sleeps on that queue and only runs the stack when
+// the controller has signalled something. The timeout recovers from a missed INT edge
 void usbh_ProcessTask(void* parameter)
 {
 	UBaseType_t uxHighWaterMark;
-	static uint8_t usbProcessCount = 0;
+#ifdef USE_LAZY_INIT
+	esp32Manager_InitUsbHost();
+#endif
 	while(1)
 	{
 		//uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL );
 		//ESP_LOGD("USBH", "USBH Process Task High Water Mark: %d", uxHighWaterMark);
-		USBHost.task(0);
-		// Feed watchdog and ensure task splitting
-		vTaskDelay(1 / portTICK_PERIOD_MS);
+		USBHost.task(USBH_EVENT_TIMEOUT_MS);
 	}
 
 }
@@ -45,94 +63,259 @@ usbh_Init()
 	USBHost.begin(1);
 }
 
+// Handles any pending host stack events without waiting
 void usbh_Process()
 {
-	USBHost.task();
+	USBHost.task(0);
 }
 
+dev_info_t* usbh_GetDevice(uint8_t daddr)
+{
+	if (daddr == 0 || daddr > USBH_MAX_DEVICES)
+	{
+		return NULL;
+	}
+	return &dev_info[daddr - 1];
+}
+
+// Prints the descriptors read during enumeration. Nothing is fetched from the device here
 void usbh_PrintDeviceDescriptor(dev_info_t *dev, uint8_t daddr)
 {
 	tusb_desc_device_t *desc = &dev->desc_device;
 
-	Serial0.printf("Device %u: ID %04x:%04x\r\n", daddr, desc->idVendor, desc->idProduct);
-	Serial0.printf("Device Descriptor:\r\n");
-	Serial0.printf("  bLength             %u\r\n", desc->bLength);
-	Serial0.printf("  bDescriptorType     %u\r\n", desc->bDescriptorType);
-	Serial0.printf("  bcdUSB              %04x\r\n", desc->bcdUSB);
-	Serial0.printf("  bDeviceClass        %u\r\n", desc->bDeviceClass);
-	Serial0.printf("  bDeviceSubClass     %u\r\n", desc->bDeviceSubClass);
-	Serial0.printf("  bDeviceProtocol     %u\r\n", desc->bDeviceProtocol);
-	Serial0.printf("  bMaxPacketSize0     %u\r\n", desc->bMaxPacketSize0);
-	Serial0.printf("  idVendor            0x%04x\r\n", desc->idVendor);
-	Serial0.printf("  idProduct           0x%04x\r\n", desc->idProduct);
-	Serial0.printf("  bcdDevice           %04x\r\n", desc->bcdDevice);
+	ESP_LOGD(TAG, "Device %u: ID %04x:%04x", daddr, desc->idVendor, desc->idProduct);
+	ESP_LOGD(TAG, "  bcdUSB              %04x", desc->bcdUSB);
+	ESP_LOGD(TAG, "  bDeviceClass        %u", desc->bDeviceClass);
+	ESP_LOGD(TAG, "  bDeviceSubClass     %u", desc->bDeviceSubClass);
+	ESP_LOGD(TAG, "  bDeviceProtocol     %u", desc->bDeviceProtocol);
+	ESP_LOGD(TAG, "  bMaxPacketSize0     %u", desc->bMaxPacketSize0);
+	ESP_LOGD(TAG, "  bcdDevice           %04x", desc->bcdDevice);
+	ESP_LOGD(TAG, "  Manufacturer        %s", (char *)dev->manufacturer);
+	ESP_LOGD(TAG, "  Product             %s", (char *)dev->product);
+	ESP_LOGD(TAG, "  Serial              %s", (char *)dev->serial);
+	ESP_LOGD(TAG, "  bNumConfigurations  %u", desc->bNumConfigurations);
+}
 
-	// Get String descriptor using Sync API
-	Serial0.printf("  iManufacturer       %u     ", desc->iManufacturer);
-	if (XFER_RESULT_SUCCESS ==
-		 tuh_descriptor_get_manufacturer_string_sync(daddr, LANGUAGE_ID, dev->manufacturer, sizeof(dev->manufacturer)))
+void usbh_GetStats(UsbhStats* stats, uint8_t reset)
+{
+	uint32_t now = millis();
+
+	portENTER_CRITICAL(&usbhStatsMux);
+	usbhStats.frames = now - usbhStatsStart;
+	*stats = usbhStats;
+	if (reset)
 	{
-		utf16_to_utf8(dev->manufacturer, sizeof(dev->manufacturer));
-		Serial0.printf((char *)dev->manufacturer);
+		memset(&usbhStats, 0, sizeof(usbhStats));
+		usbhStatsStart = now;
 	}
-	Serial0.printf("\r\n");
+	portEXIT_CRITICAL(&usbhStatsMux);
+}
 
-	Serial0.printf("  iProduct            %u     ", desc->iProduct);
-	if (XFER_RESULT_SUCCESS ==
-		 tuh_descriptor_get_product_string_sync(daddr, LANGUAGE_ID, dev->product, sizeof(dev->product)))
+// Prints the SPI counters as a diagnostics line, averaged per USB frame, and starts a new sample
+void usbh_PrintStats()
+{
+	UsbhStats stats;
+	usbh_GetStats(&stats, 1);
+	if (stats.frames == 0)
 	{
-		utf16_to_utf8(dev->product, sizeof(dev->product));
-		Serial0.printf((char *)dev->product);
+		return;
 	}
-	Serial0.printf("\r\n");
+	Serial.printf("{\"usbhStats\":{\"clock\":%lu,\"transactions\":%lu,\"bytes\":%lu,\"timeUs\":%lu,\"frames\":%lu,\"busyPerMille\":%lu}}~\n",
+						(unsigned long)USBH_SPI_CLOCK, (unsigned long)stats.spiTransactions, (unsigned long)stats.spiBytes,
+						(unsigned long)stats.spiTimeUs, (unsigned long)stats.frames,
+						(unsigned long)((uint64_t)stats.spiTimeUs / stats.frames));
+}
+
+
+//---------------------- Private Functions ----------------------//
+// Device enumeration runs as a chain of asynchronous descriptor requests, each started from
+// the completion of the previous one, so the USB host task never waits on a transfer
+void usbh_EnumComplete(tuh_xfer_t* xfer)
+{
+	uint8_t daddr = xfer->daddr;
+	dev_info_t *dev = usbh_GetDevice(daddr);
+	bool success = (xfer->result == XFER_RESULT_SUCCESS);
 
-	Serial0.printf("  iSerialNumber       %u     ", desc->iSerialNumber);
-	if (XFER_RESULT_SUCCESS ==
-		 tuh_descriptor_get_serial_string_sync(daddr, LANGUAGE_ID, dev->serial, sizeof(dev->serial)))
+	if (dev == NULL || !dev->mounted)
 	{
-		utf16_to_utf8(dev->serial, sizeof(dev->serial));
-		Serial0.printf((char *)dev->serial);
+		return;
 	}
-	Serial0.printf("\r\n");
 
-	Serial0.printf("  bNumConfigurations  %u\r\n", desc->bNumConfigurations);
+	switch (dev->enumState)
+	{
+		case UsbhEnumDevice:
+			if (!success)
+			{
+				ESP_LOGW(TAG, "Device %d: device descriptor request failed", daddr);
+				dev->enumState = UsbhEnumDone;
+				return;
+			}
+			dev->enumState = UsbhEnumConfigWait;
+			usbh_EnumNextConfig();
+			return;
 
-	// print device summary
-	print_lsusb();
+		case UsbhEnumConfig:
+			if (descScratchOwner != daddr)
+			{
+				return;
+			}
+			if (success)
+			{
+				parse_config_descriptor(daddr, (tusb_desc_configuration_t *)descScratch, xfer->actual_len);
+			}
+			else
+			{
+				ESP_LOGW(TAG, "Device %d: configuration descriptor request failed", daddr);
+			}
+			descScratchOwner = 0;
+			dev->enumState = UsbhEnumManufacturer;
+			usbh_EnumNextString(daddr, dev);
+			usbh_EnumNextConfig();
+			return;
+
+		case UsbhEnumManufacturer:
+			if (success)
+				utf16_to_utf8(dev->manufacturer, sizeof(dev->manufacturer));
+			else
+				dev->manufacturer[0] = 0;
+			dev->enumState = UsbhEnumProduct;
+			usbh_EnumNextString(daddr, dev);
+			return;
+
+		case UsbhEnumProduct:
+			if (success)
+				utf16_to_utf8(dev->product, sizeof(dev->product));
+			else
+				dev->product[0] = 0;
+			dev->enumState = UsbhEnumSerial;
+			usbh_EnumNextString(daddr, dev);
+			return;
+
+		case UsbhEnumSerial:
+			if (success)
+				utf16_to_utf8(dev->serial, sizeof(dev->serial));
+			else
+				dev->serial[0] = 0;
+			dev->enumState = UsbhEnumDone;
+			usbh_EnumNextString(daddr, dev);
+			return;
+
+		default:
+			return;
+	}
+}
+
+// Starts the configuration descriptor read of the next waiting device, if the shared buffer is free
+void usbh_EnumNextConfig(void)
+{
+	if (descScratchOwner != 0)
+	{
+		return;
+	}
+	for (uint8_t daddr = 1; daddr <= USBH_MAX_DEVICES; daddr++)
+	{
+		dev_info_t *dev = usbh_GetDevice(daddr);
+		if (dev->mounted && dev->enumState == UsbhEnumConfigWait)
+		{
+			descScratchOwner = daddr;
+			dev->enumState = UsbhEnumConfig;
+			if (tuh_descriptor_get_configuration(daddr, 0, descScratch, sizeof(descScratch), usbh_EnumComplete, 0))
+			{
+				return;
+			}
+			// skip to the strings if the request could not be queued
+			ESP_LOGW(TAG, "Device %d: configuration descriptor request not queued", daddr);
+			descScratchOwner = 0;
+			dev->enumState = UsbhEnumManufacturer;
+			usbh_EnumNextString(daddr, dev);
+		}
+	}
 }
 
+// Requests the string descriptor for the current state, skipping strings the device does not have.
+// Finishes enumeration once all strings are read
+void usbh_EnumNextString(uint8_t daddr, dev_info_t* dev)
+{
+	while (dev->enumState != UsbhEnumDone)
+	{
+		bool queued = false;
+		if (dev->enumState == UsbhEnumManufacturer)
+		{
+			dev->manufacturer[0] = 0;
+			queued = dev->desc_device.iManufacturer != 0 &&
+				tuh_descriptor_get_manufacturer_string(daddr, LANGUAGE_ID, dev->manufacturer, sizeof(dev->manufacturer), usbh_EnumComplete, 0);
+			if (!queued)
+				dev->enumState = UsbhEnumProduct;
+		}
+		else if (dev->enumState == UsbhEnumProduct)
+		{
+			dev->product[0] = 0;
+			queued = dev->desc_device.iProduct != 0 &&
+				tuh_descriptor_get_product_string(daddr, LANGUAGE_ID, dev->product, sizeof(dev->product), usbh_EnumComplete, 0);
+			if (!queued)
+				dev->enumState = UsbhEnumSerial;
+		}
+		else
+		{
+			dev->serial[0] = 0;
+			queued = dev->desc_device.iSerialNumber != 0 &&
+				tuh_descriptor_get_serial_string(daddr, LANGUAGE_ID, dev->serial, sizeof(dev->serial), usbh_EnumComplete, 0);
+			if (!queued)
+				dev->enumState = UsbhEnumDone;
+		}
+		if (queued)
+		{
+			return;
+		}
+	}
 
-//---------------------- Private Functions ----------------------//
+	dev->enumTime = millis() - dev->mountTime;
+	ESP_LOGI(TAG, "Device %d enumerated in %lu ms", daddr, (unsigned long)dev->enumTime);
+	usbh_PrintDeviceDescriptor(dev, daddr);
+	print_lsusb();
+}
 
 //---------------------- Tiny USB Callbacks ----------------------//
 // Invoked when device is mounted (configured)
 // This is the generic device mount callback. Class specific callbacks are used separately
 void tuh_mount_cb(uint8_t daddr)
 {
-	Serial0.printf("Device attached, address = %d\r\n", daddr);
+	dev_info_t *dev = usbh_GetDevice(daddr);
 
-	dev_info_t *dev = &dev_info[0];
-	tusb_desc_device_t *desc = &dev->desc_device;
+	ESP_LOGI(TAG, "Device attached, address = %d", daddr);
+	if (dev == NULL)
+	{
+		return;
+	}
+	memset((void *)dev, 0, sizeof(dev_info_t));
 	dev->mounted = true;
+	dev->mountTime = millis();
+	dev->enumState = UsbhEnumDevice;
 
-	// Get Device Descriptor
-	tuh_descriptor_get_device_sync(daddr, &dev->desc_device, 18);
-
-	uint16_t temp_buf[1024];
-	if (XFER_RESULT_SUCCESS == tuh_descriptor_get_configuration_sync(daddr, 0, temp_buf, sizeof(temp_buf)))
+	if (!tuh_descriptor_get_device(daddr, &dev->desc_device, sizeof(tusb_desc_device_t), usbh_EnumComplete, 0))
 	{
-		usbh_PrintDeviceDescriptor(dev, daddr);
-		parse_config_descriptor(daddr, (tusb_desc_configuration_t *)temp_buf);
+		ESP_LOGW(TAG, "Device %d: device descriptor request not queued", daddr);
+		dev->enumState = UsbhEnumDone;
 	}
-
 }
 
 /// Invoked when device is unmounted (bus reset/unplugged)
 void tuh_umount_cb(uint8_t daddr)
 {
-	Serial0.printf("Device removed, address = %d\r\n", daddr);
-	dev_info_t *dev = &dev_info[daddr - 1];
+	dev_info_t *dev = usbh_GetDevice(daddr);
+
+	ESP_LOGI(TAG, "Device removed, address = %d", daddr);
+	if (dev == NULL)
+	{
+		return;
+	}
 	dev->mounted = false;
+	dev->enumState = UsbhEnumIdle;
+	if (descScratchOwner == daddr)
+	{
+		descScratchOwner = 0;
+		usbh_EnumNextConfig();
+	}
 
 	// print device summary
 	print_lsusb();
@@ -141,12 +324,12 @@ void tuh_umount_cb(uint8_t daddr)
 void print_lsusb(void)
 {
 	bool no_device = true;
-	for (uint8_t daddr = 1; daddr < CFG_TUH_DEVICE_MAX + 1; daddr++)
+	for (uint8_t daddr = 1; daddr <= USBH_MAX_DEVICES; daddr++)
 	{
 		// TODO can use tuh_mounted(daddr), but tinyusb has an bug
 		// use local connected flag instead
-		dev_info_t *dev = &dev_info[daddr - 1];
-		if (dev->mounted)
+		dev_info_t *dev = usbh_GetDevice(daddr);
+		if (dev->mounted && dev->enumState == UsbhEnumDone)
 		{
 			Serial.printf("\"{newUSBHDevice\":\"Device %u: ID %04x:%04x %s %s\"}~\n", daddr,
 								dev->desc_device.idVendor, dev->desc_device.idProduct,
@@ -157,7 +340,7 @@ void print_lsusb(void)
 
 	if (no_device)
 	{
-		Serial0.println("No device connected (except hub)");
+		ESP_LOGI(TAG, "No device connected (except hub)");
 	}
 }
 
@@ -193,9 +376,11 @@ uint16_t count_interface_total_len(tusb_desc_interface_t const *desc_itf, uint8_
 }
 
 // simple configuration parser to open
-void parse_config_descriptor(uint8_t dev_addr, tusb_desc_configuration_t const *desc_cfg)
+// length is what was actually read, which can be less than wTotalLength for very large descriptors
+void parse_config_descriptor(uint8_t dev_addr, tusb_desc_configuration_t const *desc_cfg, uint16_t length)
 {
-	uint8_t const *desc_end = ((uint8_t const *)desc_cfg) + tu_le16toh(desc_cfg->wTotalLength);
+	uint16_t totalLength = tu_le16toh(desc_cfg->wTotalLength);
+	uint8_t const *desc_end = ((uint8_t const *)desc_cfg) + (totalLength < length ? totalLength : length);
 	uint8_t const *p_desc = tu_desc_next(desc_cfg);
 
 	// parse each interfaces
@@ -223,12 +408,15 @@ void parse_config_descriptor(uint8_t dev_addr, tusb_desc_configuration_t const *
 		if (drv_len < sizeof(tusb_desc_interface_t))
 			return;
 
-		// Handle CDC devices
+		// CDC interfaces are bound to their drivers from tuh_cdc_mount_cb
 		if (desc_itf->bInterfaceClass == TUSB_CLASS_CDC)
 		{
-			cdc_DeviceConfiguredHandler();
-			//cdcDeviceInitRequired = 1;
-			//tonexOne_SendHello();
+			ESP_LOGD("USBH", "CDC interface %d on device %d", desc_itf->bInterfaceNumber, dev_addr);
+		}
+		// MIDI streaming interfaces are bound from tuh_midi_mount_cb
+		else if (desc_itf->bInterfaceClass == TUSB_CLASS_AUDIO && desc_itf->bInterfaceSubClass == 0x03)
+		{
+			ESP_LOGD("USBH", "MIDI interface %d on device %d", desc_itf->bInterfaceNumber, dev_addr);
 		}
 
 		// next Interface or IAD descriptor
@@ -236,4 +424,25 @@ void parse_config_descriptor(uint8_t dev_addr, tusb_desc_configuration_t const *
 	}
 }
 
+
+#ifdef USBH_SPI_STATS
+//---------------------- SPI Instrumentation ----------------------//
+// Wraps the MAX3421E SPI transfer of the TinyUSB port, enabled with -Wl,--wrap=tuh_max3421_spi_xfer_api
+extern "C" bool __real_tuh_max3421_spi_xfer_api(uint8_t rhport, uint8_t const *tx_buf, uint8_t *rx_buf, size_t xfer_bytes);
+
+extern "C" bool __wrap_tuh_max3421_spi_xfer_api(uint8_t rhport, uint8_t const *tx_buf, uint8_t *rx_buf, size_t xfer_bytes)
+{
+	uint32_t start = micros();
+	bool result = __real_tuh_max3421_spi_xfer_api(rhport, tx_buf, rx_buf, xfer_bytes);
+	uint32_t elapsed = micros() - start;
+
+	portENTER_CRITICAL(&usbhStatsMux);
+	usbhStats.spiTransactions++;
+	usbhStats.spiBytes += xfer_bytes;
+	usbhStats.spiTimeUs += elapsed;
+	portEXIT_CRITICAL(&usbhStatsMux);
+	return result;
+}
+#endif
+
 #endif
\ No newline at end of file
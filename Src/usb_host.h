@@ -4,6 +4,37 @@
 #include <Arduino.h>
 #include <Adafruit_TinyUSB.h>
 
+// Device addresses start at 1, hubs take addresses of their own
+#define USBH_MAX_DEVICES		(CFG_TUH_DEVICE_MAX + CFG_TUH_HUB)
+
+// MAX3421E SPI clock. The part is rated to 26 MHz, the ESP32 divides this down to the nearest
+// clock it can generate from 80 MHz (20 MHz for the default)
+#ifndef USBH_SPI_CLOCK
+#define USBH_SPI_CLOCK			26000000UL
+#endif
+
+// SPI counters since the last reset. They need USBH_SPI_STATS and the linker option
+// -Wl,--wrap=tuh_max3421_spi_xfer_api, otherwise they stay at 0
+typedef struct
+{
+	uint32_t spiTransactions;
+	uint32_t spiBytes;
+	uint32_t spiTimeUs;
+	uint32_t frames;				// 1 ms USB frames covered by the counters
+} UsbhStats;
+
+typedef enum
+{
+	UsbhEnumIdle = 0,
+	UsbhEnumDevice,				// fetching the device descriptor
+	UsbhEnumConfigWait,			// waiting for the shared descriptor buffer
+	UsbhEnumConfig,
+	UsbhEnumManufacturer,
+	UsbhEnumProduct,
+	UsbhEnumSerial,
+	UsbhEnumDone
+} UsbhEnumState;
+
 typedef struct
 {
 	tusb_desc_device_t desc_device;
@@ -11,15 +42,22 @@ typedef struct
 	uint16_t product[48];
 	uint16_t serial[16];
 	bool mounted;
+	UsbhEnumState enumState;
+	uint32_t mountTime;				// ms
+	uint32_t enumTime;				// ms from mount until all descriptors were read
 } dev_info_t;
 
 extern dev_info_t dev_info[];
 
+dev_info_t* usbh_GetDevice(uint8_t daddr);
+
 void usbh_Init();
 void usbh_ProcessTask(void* parameter);
 void usbh_Process();
 
 void usbh_PrintDeviceDescriptor(dev_info_t *dev, uint8_t daddr);
+void usbh_GetStats(UsbhStats* stats, uint8_t reset);
+void usbh_PrintStats();
 
 #endif
 #endif // USBHOST_H_
\ No newline at end of file
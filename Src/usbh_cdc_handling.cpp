@@ -5,262 +5,518 @@
 #include "usbh_cdc_handling.h"
 #include "usb_host.h"
 
+#ifdef USE_TONEX_ONE
 #include "tonexOne.h"
-#include "tonexOne_Interface.h"
+#endif
 
-#define BULK_XFER_DELAY 3 // ms
-
-Adafruit_USBH_CDC SerialHost;
+#define CDC_TX_MAX_MESSAGES		32
+#define CDC_TX_PACKET_SIZE			64			// bulk OUT max packet size
+#define CDC_TX_TIMEOUT				50			// ms to wait for a transfer to complete
+#define CDC_TASK_PERIOD				2			// ms between driver ticks when nothing wakes the task
 
 static const char *TAG = "USB_CDC_Handling";
 
-uint8_t cdcDeviceIdx = 0;
-uint8_t cdcDeviceMounted = 0;
-dev_info_t *cdcDevice;
-CDCDeviceType cdcDeviceType = CDCDeviceNone;
-uint8_t cdcDeviceInitRequired = 0;
+// Framed messages queued for a CDC device. Bytes live in a ring and each message keeps its
+// length so it can be segmented without splitting into the next one
+typedef struct
+{
+	uint8_t* data;
+	uint16_t size;
+	uint16_t head;
+	uint16_t tail;
+	uint16_t count;
+	uint16_t lengths[CDC_TX_MAX_MESSAGES];
+	uint8_t msgHead;
+	uint8_t msgTail;
+	uint8_t msgCount;
+	uint16_t msgRemaining;			// bytes of the oldest message still to be sent
+	uint16_t buildHead;				// write cursor of the message being built
+	uint16_t buildLength;
+	uint8_t building;
+	uint8_t buildOverflow;
+	volatile uint8_t inFlight;
+	uint32_t startTime;
+} CdcTxQueue;
+
+typedef enum
+{
+	CdcSlotFree = 0,
+	CdcSlotInitRequired,			// bound to a driver by the mount callback, waiting for the CDC task
+	CdcSlotActive,
+	CdcSlotRemoveRequired			// unmounted, waiting for the CDC task to tear it down
+} CdcSlotState;
+
+typedef struct
+{
+	volatile CdcSlotState state;
+	uint8_t idx;						// TinyUSB CDC interface index
+	uint8_t daddr;
+	const CdcDriver* driver;
+	uint8_t started;					// driver init accepted the device
+	uint8_t* rxBuffer;
+	CdcTxQueue txQueue;
+} CdcSlot;
 
-uint8_t cdcTransferInProgress = 0;
+static const CdcDriver* cdcDrivers[CDC_MAX_DRIVERS];
+static uint8_t cdcDriverCount = 0;
+static CdcSlot cdcSlots[CDC_MAX_DEVICES];
+static portMUX_TYPE cdcMux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t cdcTaskHandle = NULL;
 
 //---------------------- Private Function Prototypes ----------------------//
+const CdcDriver* cdc_MatchDriver(uint16_t vid, uint16_t pid, uint8_t interfaceClass);
+void cdc_StartSlot(uint8_t slot);
+void cdc_StopSlot(uint8_t slot);
+void cdc_ProcessRx(uint8_t slot);
+void cdc_ProcessTx(uint8_t slot);
+void cdc_WakeTask();
 
 //---------------------- Public Functions ----------------------//
 void cdc_Init()
 {
-	SerialHost.begin(115200);
+#ifdef USE_TONEX_ONE
+	tonexOne_RegisterCdcDriver();
+#endif
+}
+
+uint8_t cdc_RegisterDriver(const CdcDriver* driver)
+{
+	if(driver == NULL || driver->txBufferSize == 0 || driver->rxBufferSize == 0)
+	{
+		return 0;
+	}
+	if(cdcDriverCount >= CDC_MAX_DRIVERS)
+	{
+		ESP_LOGE(TAG, "No room to register CDC driver %s", driver->name);
+		return 0;
+	}
+	cdcDrivers[cdcDriverCount] = driver;
+	cdcDriverCount++;
+	ESP_LOGI(TAG, "Registered CDC driver %s", driver->name);
+	return 1;
+}
+
+uint8_t cdc_IsActive(uint8_t slot)
+{
+	return slot < CDC_MAX_DEVICES && cdcSlots[slot].state == CdcSlotActive;
 }
 
 void cdch_ProcessTask(void* parameter)
 {
+	cdcTaskHandle = xTaskGetCurrentTaskHandle();
 	while(1)
 	{
 		//UBaseType_t uxHighWaterMark;
 		//uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL );
 		//ESP_LOGD(TAG, "CDC Process Task High Water Mark: %d", uxHighWaterMark);
-		// If a CDC device has been mounted correctly, read any available serial data and process events
-		if (cdcDeviceMounted)
+		for(uint8_t slot = 0; slot < CDC_MAX_DEVICES; slot++)
 		{
-			uint8_t buf[64];
-			if (SerialHost.connected() && SerialHost.available())
+			switch(cdcSlots[slot].state)
 			{
-				size_t count = SerialHost.read(buf, sizeof(buf));
+				case CdcSlotInitRequired:
+					cdc_StartSlot(slot);
+					break;
 
-				// For specific connected devices
-				if (cdcDeviceType == CDCDeviceTonexOne)
-				{
-					tonexOne_HandleReceivedData((char *)buf, count);
-				}
-			}
-			if(cdcDeviceType == CDCDeviceTonexOne)
-			{
-				if(cdcDeviceInitRequired == 0)
-					tonexOne_Process();
-			}
-			if(cdcTransferInProgress)
-			{
-				cdc_Transmit(NULL, 0);
-			}
-		}
-		if(cdcDeviceInitRequired)
-		{
-			if(cdcDeviceType == CDCDeviceTonexOne)
-			{
-				tonexOne_Init();
-				tonexOne_InterfaceInit();
-				tonexOne_SendHello();
-				//tonexOne_SendHello();
+				case CdcSlotActive:
+					cdc_ProcessRx(slot);
+					if(cdcSlots[slot].driver->tick != NULL)
+					{
+						cdcSlots[slot].driver->tick(slot);
+					}
+					cdc_ProcessTx(slot);
+					break;
+
+				case CdcSlotRemoveRequired:
+					cdc_StopSlot(slot);
+					break;
+
+				default:
+					break;
 			}
-			cdcDeviceInitRequired = 0;
 		}
-		// Feed watchdog and ensure task splitting
-		vTaskDelay(2 / portTICK_PERIOD_MS);
+		// Sleep until USB activity or new TX data, or the next tick is due
+		ulTaskNotifyTake(pdTRUE, CDC_TASK_PERIOD / portTICK_PERIOD_MS);
 	}
 }
 
-uint16_t cdc_Transmit(uint8_t* buffer, size_t len)
+// Queues a complete framed message for transmission. Returns the number of bytes queued, which
+// is either len or 0 when the queue cannot take the whole message
+uint16_t cdc_Transmit(uint8_t slot, uint8_t* buffer, size_t len)
 {
-	int availableSize = 0;						// size of the buffer available for writing (to check for errors)
-	uint32_t transmitStartTime = millis();	// start time of the transmission
-	static uint16_t remainingBytes = 0;
-	static uint16_t sentBytes = 0;
-	static uint8_t *bufferPtr = NULL;
-	static size_t bufferSize = 0;
-	static uint16_t xferCounter = 0;
+	if(buffer == NULL || len == 0 || len > 0xFFFF)
+	{
+		return 0;
+	}
+	if(!cdc_TransmitBegin(slot))
+	{
+		return 0;
+	}
+	for(size_t i = 0; i < len; i++)
+	{
+		cdc_TransmitPut(slot, buffer[i]);
+	}
+	return cdc_TransmitEnd(slot);
+}
 
-	if(!cdcDeviceMounted)
+// Starts building a message directly in the TX ring. Nothing is visible to the transmitter
+// until cdc_TransmitEnd, so a partly built message is never sent
+uint8_t cdc_TransmitBegin(uint8_t slot)
+{
+	if(!cdc_IsActive(slot))
 	{
-		ESP_LOGD(TAG, "No CDC device mounted, cannot transmit data");
+		ESP_LOGD(TAG, "No CDC device active in slot %d, cannot transmit data", slot);
 		return 0;
 	}
-	// Check that an existing transfer is not already in progress
-	if(cdcTransferInProgress && len != 0)
+	CdcTxQueue* txQueue = &cdcSlots[slot].txQueue;
+
+	portENTER_CRITICAL(&cdcMux);
+	if(txQueue->building)
 	{
-		ESP_LOGD(TAG, "CDC transmit already in progress, aborting new transfer");
+		portEXIT_CRITICAL(&cdcMux);
+		ESP_LOGW(TAG, "CDC message already being built");
 		return 0;
 	}
-	
-	// Start of a new transfer
-	if(!cdcTransferInProgress && len > 0 && buffer != NULL)
-	{
-		bufferPtr = buffer;
-		bufferSize = len;
-		xferCounter = 1;
-		cdcTransferInProgress = 1;
-		sentBytes = 0;
-		remainingBytes = bufferSize;
-		uint8_t packetSize = 0;
-		// Transfer is longer than 64 bytes and needs to be split into multiple packets
-		if(bufferSize > 64)
-		{
-			packetSize = 64;
-		}
-		else
-		{
-			packetSize = bufferSize;
-		}
-		ESP_LOGD(TAG, "First transfer of %d bytes to CDC device", packetSize);
-		// Check that the driver is ready for writing more data
-		availableSize = SerialHost.availableForWrite();
-		while(availableSize < packetSize)
-		{
-			// check for timeout event of 50ms
-			if(millis() - transmitStartTime > 50)
-			{
-				ESP_LOGE(TAG, "CDC transmit timeout after %d ms", millis() - transmitStartTime);
-				return sentBytes;
-			}
-			availableSize = SerialHost.availableForWrite();
-			usbh_Process();
-			vTaskDelay(1/portTICK_PERIOD_MS);
-		}
-		// print the data packet for error checking
-		//esp_log_buffer_hex_internal(TAG, bufferPtr, packetSize, ESP_LOG_DEBUG);
-		if(SerialHost.write(bufferPtr, packetSize) != packetSize)
-		{
-			return sentBytes;
-		}
-		vTaskDelay(2);
-		
-		remainingBytes -= packetSize;
-		sentBytes = packetSize;
-		// If all the data has been sent, reset the transfer variables
-		if(remainingBytes == 0)
-		{
-			cdcTransferInProgress = 0;
-			bufferPtr = NULL;
-			bufferSize = 0;
-			ESP_LOGD(TAG, "CDC transfer complete, %d bytes sent", sentBytes);
-		}
-		//vTaskDelay(BULK_XFER_DELAY/portTICK_PERIOD_MS);
-		return sentBytes;
+	txQueue->building = 1;
+	txQueue->buildOverflow = 0;
+	txQueue->buildHead = txQueue->head;
+	txQueue->buildLength = 0;
+	portEXIT_CRITICAL(&cdcMux);
+	return 1;
+}
 
+// Appends a byte to the message being built. The transmitter only ever frees space, so the
+// free space check is safe without the lock
+uint8_t cdc_TransmitPut(uint8_t slot, uint8_t byte)
+{
+	if(slot >= CDC_MAX_DEVICES)
+	{
+		return 0;
 	}
-	// If a transfer is in progress, send the next packet
-	else if(cdcTransferInProgress && buffer == NULL && len == 0)
+	CdcTxQueue* txQueue = &cdcSlots[slot].txQueue;
+
+	if(!txQueue->building || txQueue->buildOverflow)
 	{
-		uint8_t packetSize = 0;
-		// Transfer is longer than 64 bytes and needs to be split into multiple packets
-		if(remainingBytes > 64)
-		{
-			packetSize = 64;
-		}
-		else
-		{
-			packetSize = remainingBytes;
-		}
-		ESP_LOGD(TAG, "Transfer (%d) of %d bytes to CDC device", xferCounter+1, packetSize);
-		// Check that the driver is ready for writing more data
-		availableSize = SerialHost.availableForWrite();
-		while(availableSize < packetSize)
+		return 0;
+	}
+	if((uint32_t)txQueue->count + txQueue->buildLength >= txQueue->size)
+	{
+		txQueue->buildOverflow = 1;
+		return 0;
+	}
+	txQueue->data[txQueue->buildHead] = byte;
+	txQueue->buildHead = (txQueue->buildHead + 1) % txQueue->size;
+	txQueue->buildLength++;
+	return 1;
+}
+
+// Hands the built message to the transmitter. Returns its length, or 0 if it did not fit
+uint16_t cdc_TransmitEnd(uint8_t slot)
+{
+	uint16_t length = 0;
+
+	if(slot >= CDC_MAX_DEVICES)
+	{
+		return 0;
+	}
+	CdcTxQueue* txQueue = &cdcSlots[slot].txQueue;
+
+	portENTER_CRITICAL(&cdcMux);
+	if(txQueue->building && !txQueue->buildOverflow && txQueue->buildLength > 0 &&
+		txQueue->msgCount < CDC_TX_MAX_MESSAGES)
+	{
+		length = txQueue->buildLength;
+		txQueue->head = txQueue->buildHead;
+		txQueue->count += length;
+		txQueue->lengths[txQueue->msgHead] = length;
+		txQueue->msgHead = (txQueue->msgHead + 1) % CDC_TX_MAX_MESSAGES;
+		txQueue->msgCount++;
+	}
+	txQueue->building = 0;
+	portEXIT_CRITICAL(&cdcMux);
+
+	if(length == 0)
+	{
+		ESP_LOGW(TAG, "CDC transmit queue full, dropping message");
+	}
+	else
+	{
+		cdc_WakeTask();
+	}
+	return length;
+}
+
+
+//---------------------- Private Functions ----------------------//
+// Picks the most specific registered driver for an interface
+const CdcDriver* cdc_MatchDriver(uint16_t vid, uint16_t pid, uint8_t interfaceClass)
+{
+	const CdcDriver* best = NULL;
+	uint8_t bestScore = 0;
+
+	for(uint8_t i = 0; i < cdcDriverCount; i++)
+	{
+		const CdcDriver* driver = cdcDrivers[i];
+		uint8_t score = 1;
+
+		if(driver->vid != CDC_MATCH_ANY)
 		{
-			// check for timeout event of 50ms
-			if(millis() - transmitStartTime > 50)
-			{
-				// Flush and try again
-				ESP_LOGE(TAG, "CDC transmit timeout after %d ms", millis() - transmitStartTime);
-				return sentBytes;
-			}
-			usbh_Process();
-			availableSize = SerialHost.availableForWrite();
-			vTaskDelay(1/portTICK_PERIOD_MS);
+			if(driver->vid != vid)
+				continue;
+			score += 2;
 		}
-		xferCounter++;
-		// print the data packet for error checking
-		//esp_log_buffer_hex_internal(TAG, bufferPtr, packetSize, ESP_LOG_DEBUG);
-		if(SerialHost.write(&bufferPtr[sentBytes], packetSize) != packetSize)
+		if(driver->pid != CDC_MATCH_ANY)
 		{
-			return sentBytes;
+			if(driver->pid != pid)
+				continue;
+			score += 2;
 		}
-		//vTaskDelay(2);
-		
-		
-		remainingBytes -= packetSize;
-		sentBytes += packetSize;
-		// If all the data has been sent, reset the transfer variables
-		if(remainingBytes == 0)
+		if(driver->interfaceClass != CDC_MATCH_ANY)
 		{
-			cdcTransferInProgress = 0;
-			bufferPtr = NULL;
-			bufferSize = 0;
-			xferCounter = 0;
-			ESP_LOGD(TAG, "CDC transfer complete, %d bytes sent", sentBytes);
-			SerialHost.flush();
+			if(driver->interfaceClass != interfaceClass)
+				continue;
+			score += 1;
 		}
-		else
+		if(score > bestScore)
 		{
-			
+			best = driver;
+			bestScore = score;
 		}
-		//vTaskDelay(BULK_XFER_DELAY/portTICK_PERIOD_MS);
-		return sentBytes;
 	}
+	return best;
 }
 
-uint16_t cdc_HandleTransfer(uint8_t *buffer, uint16_t length)
+// Allocates the driver's buffers and runs its init. Runs in the CDC task
+void cdc_StartSlot(uint8_t slot)
 {
+	CdcSlot* cdc = &cdcSlots[slot];
+	const CdcDriver* driver = cdc->driver;
+
+	memset((void*)&cdc->txQueue, 0, sizeof(CdcTxQueue));
+	cdc->rxBuffer = (uint8_t*)heap_caps_malloc(driver->rxBufferSize, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	cdc->txQueue.data = (uint8_t*)heap_caps_malloc(driver->txBufferSize, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	cdc->txQueue.size = driver->txBufferSize;
+	if(cdc->rxBuffer == NULL || cdc->txQueue.data == NULL)
+	{
+		ESP_LOGE(TAG, "Failed to allocate buffers for %s", driver->name);
+		cdc_StopSlot(slot);
+		return;
+	}
+	if(driver->baudRate != 0)
+	{
+		tuh_cdc_set_baudrate(cdc->idx, driver->baudRate, NULL, 0);
+	}
 
+	// the device may have gone while the buffers were allocated
+	portENTER_CRITICAL(&cdcMux);
+	if(cdc->state == CdcSlotInitRequired)
+	{
+		cdc->state = CdcSlotActive;
+	}
+	portEXIT_CRITICAL(&cdcMux);
+	if(cdc->state != CdcSlotActive)
+	{
+		cdc_StopSlot(slot);
+		return;
+	}
+
+	if(driver->init != NULL && !driver->init(slot))
+	{
+		ESP_LOGW(TAG, "%s declined device %d", driver->name, cdc->daddr);
+		cdc_StopSlot(slot);
+		return;
+	}
+	cdc->started = 1;
+	ESP_LOGI(TAG, "%s started in slot %d", driver->name, slot);
 }
 
-void cdc_DeviceConfiguredHandler()
+// Tears a slot down after its device has gone or its driver declined it. Runs in the CDC task
+void cdc_StopSlot(uint8_t slot)
 {
-	cdcDevice = &dev_info[cdcDeviceIdx];
-	tusb_desc_device_t *desc = &cdcDevice->desc_device;
-	ESP_LOGI(TAG, "  idVendor            0x%04x\r\n", desc->idVendor);
-	ESP_LOGI(TAG, "  idProduct           0x%04x\r\n", desc->idProduct);
+	CdcSlot* cdc = &cdcSlots[slot];
 
-	// Currently, the only supported CDC device is the Tonex One
-	if (cdcDevice->desc_device.idVendor == TONEX_ONE_VID &&
-		 cdcDevice->desc_device.idProduct == TONEX_ONE_PID)
+	if(cdc->started && cdc->driver->deinit != NULL)
 	{
-		ESP_LOGI(TAG, "Tonex One found at idx %d. Mounting CDC Serial device.", cdcDeviceIdx);
-		SerialHost.mount(cdcDeviceIdx);
-		cdcDeviceType = CDCDeviceTonexOne;
-		cdcDeviceInitRequired = 1;
+		cdc->driver->deinit(slot);
 	}
+	heap_caps_free(cdc->rxBuffer);
+	heap_caps_free(cdc->txQueue.data);
+	cdc->rxBuffer = NULL;
+
+	portENTER_CRITICAL(&cdcMux);
+	memset((void*)&cdc->txQueue, 0, sizeof(CdcTxQueue));
+	cdc->driver = NULL;
+	cdc->started = 0;
+	cdc->state = CdcSlotFree;
+	portEXIT_CRITICAL(&cdcMux);
 }
 
+void cdc_ProcessRx(uint8_t slot)
+{
+	CdcSlot* cdc = &cdcSlots[slot];
+	uint32_t count = tuh_cdc_read_available(cdc->idx);
 
-//---------------------- Private Functions ----------------------//
+	if(count == 0)
+	{
+		return;
+	}
+	count = tuh_cdc_read(cdc->idx, cdc->rxBuffer, cdc->driver->rxBufferSize);
+	if(count > 0 && cdc->driver->rx != NULL)
+	{
+		cdc->driver->rx(slot, cdc->rxBuffer, count);
+	}
+}
+
+// Starts the next bulk transfer once the previous one has completed. Each transfer is at most
+// one max packet, and the last packet of a message is never a full one so the device sees a
+// short packet at the end of every message without needing a ZLP
+void cdc_ProcessTx(uint8_t slot)
+{
+	uint8_t idx = cdcSlots[slot].idx;
+	CdcTxQueue* txQueue = &cdcSlots[slot].txQueue;
+	uint8_t packet[CDC_TX_PACKET_SIZE];
+	uint16_t packetSize;
+
+	if(txQueue->inFlight)
+	{
+		if(millis() - txQueue->startTime < CDC_TX_TIMEOUT)
+		{
+			return;
+		}
+		ESP_LOGE(TAG, "CDC transfer not completed after %d ms", CDC_TX_TIMEOUT);
+		txQueue->inFlight = 0;
+	}
+
+	portENTER_CRITICAL(&cdcMux);
+	if(txQueue->msgRemaining == 0 && txQueue->msgCount > 0)
+	{
+		txQueue->msgRemaining = txQueue->lengths[txQueue->msgTail];
+		txQueue->msgTail = (txQueue->msgTail + 1) % CDC_TX_MAX_MESSAGES;
+		txQueue->msgCount--;
+	}
+	packetSize = txQueue->msgRemaining;
+	if(packetSize > CDC_TX_PACKET_SIZE)
+	{
+		packetSize = CDC_TX_PACKET_SIZE;
+	}
+	if(packetSize == CDC_TX_PACKET_SIZE && txQueue->msgRemaining == CDC_TX_PACKET_SIZE)
+	{
+		packetSize = CDC_TX_PACKET_SIZE - 1;
+	}
+	for(uint16_t i = 0; i < packetSize; i++)
+	{
+		packet[i] = txQueue->data[(txQueue->tail + i) % txQueue->size];
+	}
+	portEXIT_CRITICAL(&cdcMux);
+
+	if(packetSize == 0 || tuh_cdc_write_available(idx) < packetSize)
+	{
+		return;
+	}
+	if(tuh_cdc_write(idx, packet, packetSize) != packetSize)
+	{
+		ESP_LOGE(TAG, "CDC write of %d bytes failed", packetSize);
+		return;
+	}
+	txQueue->startTime = millis();
+	txQueue->inFlight = 1;
+	tuh_cdc_write_flush(idx);
+
+	portENTER_CRITICAL(&cdcMux);
+	txQueue->tail = (txQueue->tail + packetSize) % txQueue->size;
+	txQueue->count -= packetSize;
+	txQueue->msgRemaining -= packetSize;
+	portEXIT_CRITICAL(&cdcMux);
+}
+
+// Callbacks run in the USB host task, so the CDC task can be notified directly
+void cdc_WakeTask()
+{
+	if(cdcTaskHandle != NULL)
+	{
+		xTaskNotifyGive(cdcTaskHandle);
+	}
+}
 
 
 //---------------------- Tiny USB Callbacks ----------------------//
 // Invoked when a device with CDC interface is mounted
 // idx is index of cdc interface in the internal pool.
-
+// The interface is bound to a driver here, the driver itself is started by the CDC task
 extern "C" void tuh_cdc_mount_cb(uint8_t idx)
 {
-	// Bind SerialHost object to this interface index
-	cdcDeviceIdx = idx;
-	cdcDeviceMounted = 1;
-	SerialHost.mount(idx);
+	tuh_itf_info_t info;
+	uint16_t vid = 0;
+	uint16_t pid = 0;
+
+	if(!tuh_cdc_itf_get_info(idx, &info) || !tuh_vid_pid_get(info.daddr, &vid, &pid))
+	{
+		return;
+	}
+	ESP_LOGI(TAG, "CDC interface %d mounted, device %d ID %04x:%04x", idx, info.daddr, vid, pid);
+
+	const CdcDriver* driver = cdc_MatchDriver(vid, pid, info.desc.bInterfaceClass);
+	if(driver == NULL)
+	{
+		ESP_LOGW(TAG, "No CDC driver for %04x:%04x", vid, pid);
+		return;
+	}
+
+	portENTER_CRITICAL(&cdcMux);
+	for(uint8_t slot = 0; slot < CDC_MAX_DEVICES; slot++)
+	{
+		if(cdcSlots[slot].state == CdcSlotFree)
+		{
+			cdcSlots[slot].idx = idx;
+			cdcSlots[slot].daddr = info.daddr;
+			cdcSlots[slot].driver = driver;
+			cdcSlots[slot].state = CdcSlotInitRequired;
+			driver = NULL;
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&cdcMux);
+
+	if(driver != NULL)
+	{
+		ESP_LOGW(TAG, "No free CDC slot for %s", driver->name);
+		return;
+	}
+	cdc_WakeTask();
 }
 
 // Invoked when a device with CDC interface is unmounted
 extern "C" void tuh_cdc_umount_cb(uint8_t idx)
 {
-	cdcDeviceMounted = 0;
-	cdcDevice = NULL;
-	SerialHost.umount(idx);
-	ESP_LOGV(TAG, "SerialHost is disconnected");
+	portENTER_CRITICAL(&cdcMux);
+	for(uint8_t slot = 0; slot < CDC_MAX_DEVICES; slot++)
+	{
+		if(cdcSlots[slot].state != CdcSlotFree && cdcSlots[slot].idx == idx)
+		{
+			cdcSlots[slot].state = CdcSlotRemoveRequired;
+		}
+	}
+	portEXIT_CRITICAL(&cdcMux);
+	cdc_WakeTask();
+	ESP_LOGV(TAG, "CDC interface %d is disconnected", idx);
+}
+
+// Invoked when a bulk OUT transfer to a CDC device has completed
+extern "C" void tuh_cdc_tx_complete_cb(uint8_t idx)
+{
+	for(uint8_t slot = 0; slot < CDC_MAX_DEVICES; slot++)
+	{
+		if(cdcSlots[slot].state != CdcSlotFree && cdcSlots[slot].idx == idx)
+		{
+			cdcSlots[slot].txQueue.inFlight = 0;
+		}
+	}
+	cdc_WakeTask();
+}
+
+// Invoked when bulk IN data from a CDC device has been received
+extern "C" void tuh_cdc_rx_cb(uint8_t idx)
+{
+	cdc_WakeTask();
 }
 
-#endif
\ No newline at end of file
+#endif
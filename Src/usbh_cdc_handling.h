@@ -3,22 +3,38 @@
 
 #include "Adafruit_TinyUSB.h"
 
-typedef enum
+// One slot per CDC interface TinyUSB can mount, so several devices can be attached through a hub
+#define CDC_MAX_DEVICES				CFG_TUH_CDC
+#define CDC_MAX_DRIVERS				4
+#define CDC_SLOT_NONE					0xFF
+#define CDC_MATCH_ANY					0xFFFF
+
+// A protocol driver for a CDC device. Drivers are matched on VID/PID and interface class, any of
+// which can be CDC_MATCH_ANY. An exact VID/PID match is preferred over a class only match.
+// All callbacks run in the CDC task
+typedef struct
 {
-	CDCDeviceNone = 0,
-	CDCDeviceTonexOne = 1,
-	CDCDeviceUnknown = 2,
-} CDCDeviceType;
+	const char* name;
+	uint16_t vid;
+	uint16_t pid;
+	uint16_t interfaceClass;
+	uint32_t baudRate;				// 0 leaves the line coding as enumerated
+	uint16_t rxBufferSize;			// most bytes passed to rx in one call
+	uint16_t txBufferSize;			// TX ring size, bounds the largest framed message
+	uint8_t (*init)(uint8_t slot);	// return 0 to decline the device
+	void (*deinit)(uint8_t slot);
+	void (*rx)(uint8_t slot, uint8_t* data, uint16_t length);
+	void (*tick)(uint8_t slot);
+} CdcDriver;
 
 void cdc_Init();
 void cdch_ProcessTask(void* parameter);
-uint16_t cdc_Transmit(uint8_t* buffer, size_t len);
-void cdc_DeviceConfiguredHandler();
-
-extern Adafruit_USBH_CDC SerialHost;
+uint8_t cdc_RegisterDriver(const CdcDriver* driver);
+uint8_t cdc_IsActive(uint8_t slot);
 
-extern uint8_t cdcDeviceInitRequired;
-extern uint8_t cdcDeviceMounted;
-extern CDCDeviceType cdcDeviceType;
+uint16_t cdc_Transmit(uint8_t slot, uint8_t* buffer, size_t len);
+uint8_t cdc_TransmitBegin(uint8_t slot);
+uint8_t cdc_TransmitPut(uint8_t slot, uint8_t byte);
+uint16_t cdc_TransmitEnd(uint8_t slot);
 
-#endif // _USB_CDC_HANDLING_H_
\ No newline at end of file
+#endif // _USB_CDC_HANDLING_H_
@@ -0,0 +1,398 @@
+#ifdef USE_USBH_MIDI
+
+#include "Arduino.h"
+#include "Adafruit_TinyUSB.h"
+#include "usbh_midi_handling.h"
+
+#if !defined(CFG_TUH_MIDI) || (CFG_TUH_MIDI == 0)
+#error "USE_USBH_MIDI requires CFG_TUH_MIDI to be enabled in the TinyUSB host configuration"
+#endif
+
+#define USBH_MIDI_PACKET_SIZE				4
+#define USBH_MIDI_PACKETS_PER_READ		16			// one full speed bulk transfer
+#define USBH_MIDI_TX_BACKLOG				64			// packets held per interface while its TX FIFO is full, power of 2
+
+static const char *TAG = "USBH_MIDI";
+
+typedef struct
+{
+	uint8_t used;
+	uint8_t idx;						// TinyUSB MIDI interface index
+	uint8_t cable;
+	uint8_t sysExOverflow;
+	uint16_t sysExLength;
+	uint8_t* sysExBuffer;
+} UsbhMidiPort;
+
+static UsbhMidiPort ports[USBH_MIDI_MAX_PORTS];
+static volatile uint8_t rxPending[CFG_TUH_MIDI];
+static uint8_t txPending[CFG_TUH_MIDI];
+static uint8_t txBacklog[CFG_TUH_MIDI][USBH_MIDI_TX_BACKLOG][USBH_MIDI_PACKET_SIZE];
+static uint16_t txBacklogHead[CFG_TUH_MIDI];
+static uint16_t txBacklogTail[CFG_TUH_MIDI];
+static portMUX_TYPE portsMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void (*messageCallback)(uint8_t port, uint8_t status, uint8_t data1, uint8_t data2) = nullptr;
+static void (*sysExCallback)(uint8_t port, uint8_t* array, unsigned size) = nullptr;
+
+//---------------------- Private Function Prototypes ----------------------//
+uint8_t midih_FindPort(uint8_t idx, uint8_t cable);
+void midih_HandlePacket(uint8_t port, const uint8_t* packet);
+void midih_SysExByte(uint8_t port, uint8_t byte);
+void midih_DrainBacklog(uint8_t idx);
+uint8_t midih_WritePacket(uint8_t port, uint8_t cin, uint8_t byte0, uint8_t byte1, uint8_t byte2);
+
+//---------------------- Public Functions ----------------------//
+void midih_Init()
+{
+	memset((void*)ports, 0, sizeof(ports));
+	for(uint8_t port = 0; port < USBH_MIDI_MAX_PORTS; port++)
+	{
+		ports[port].sysExBuffer = (uint8_t*)heap_caps_malloc(USBH_MIDI_SYSEX_MAX_SIZE, MALLOC_CAP_SPIRAM);
+		if(ports[port].sysExBuffer == NULL)
+		{
+			ESP_LOGE(TAG, "Failed to allocate SysEx buffer for port %d", port);
+		}
+	}
+}
+
+uint8_t midih_PortConnected(uint8_t port)
+{
+	return port < USBH_MIDI_MAX_PORTS && ports[port].used;
+}
+
+// Reads whole bulk transfers from every device with data waiting, then moves any backlog into
+// the TX FIFO and flushes anything written since the last pass. Called from the MIDI task
+void midih_Process()
+{
+	uint8_t packets[USBH_MIDI_PACKETS_PER_READ * USBH_MIDI_PACKET_SIZE];
+
+	for(uint8_t idx = 0; idx < CFG_TUH_MIDI; idx++)
+	{
+		if(rxPending[idx])
+		{
+			rxPending[idx] = 0;
+			uint32_t count;
+			do
+			{
+				count = tuh_midi_packet_read_n(idx, packets, USBH_MIDI_PACKETS_PER_READ);
+				for(uint32_t i = 0; i < count; i++)
+				{
+					const uint8_t* packet = &packets[i * USBH_MIDI_PACKET_SIZE];
+					uint8_t port = midih_FindPort(idx, packet[0] >> 4);
+					if(port < USBH_MIDI_MAX_PORTS)
+					{
+						midih_HandlePacket(port, packet);
+					}
+				}
+			} while(count == USBH_MIDI_PACKETS_PER_READ);
+		}
+		midih_DrainBacklog(idx);
+		if(txPending[idx])
+		{
+			txPending[idx] = 0;
+			tuh_midi_write_flush(idx);
+		}
+	}
+}
+
+// Sends a channel or system message. The status byte includes the channel
+uint8_t midih_SendMessage(uint8_t port, uint8_t status, uint8_t data1, uint8_t data2)
+{
+	uint8_t cin;
+
+	if(status < 0xF0)
+	{
+		cin = status >> 4;
+	}
+	else if(status == 0xF1 || status == 0xF3)
+	{
+		cin = 0x2;
+	}
+	else if(status == 0xF2)
+	{
+		cin = 0x3;
+	}
+	else if(status == 0xF6)
+	{
+		cin = 0x5;
+	}
+	else if(status >= 0xF8)
+	{
+		cin = 0xF;
+	}
+	else
+	{
+		// SysEx goes through midih_SendSysEx
+		return 0;
+	}
+	return midih_WritePacket(port, cin, status, data1, data2);
+}
+
+// Sends a USB MIDI event packet that was already encoded. The cable number is replaced with the
+// port's own
+uint8_t midih_SendPacket(uint8_t port, const uint8_t* packet)
+{
+	return midih_WritePacket(port, packet[0] & 0x0F, packet[1], packet[2], packet[3]);
+}
+
+// Splits a SysEx message into 3 byte event packets. Without containsFraming the F0/F7 bytes
+// are added here
+uint8_t midih_SendSysEx(uint8_t port, const uint8_t* array, unsigned size, uint8_t containsFraming)
+{
+	uint8_t chunk[3];
+	uint8_t chunkLength = 0;
+	unsigned total = containsFraming ? size : size + 2;
+
+	for(unsigned i = 0; i < total; i++)
+	{
+		if(containsFraming)
+			chunk[chunkLength] = array[i];
+		else if(i == 0)
+			chunk[chunkLength] = 0xF0;
+		else if(i == total - 1)
+			chunk[chunkLength] = 0xF7;
+		else
+			chunk[chunkLength] = array[i - 1];
+		chunkLength++;
+
+		if(i == total - 1)
+		{
+			// the last packet says how many bytes end the message
+			uint8_t cin = 0x4 + chunkLength;
+			if(!midih_WritePacket(port, cin, chunk[0], chunkLength > 1 ? chunk[1] : 0, chunkLength > 2 ? chunk[2] : 0))
+				return 0;
+		}
+		else if(chunkLength == 3)
+		{
+			if(!midih_WritePacket(port, 0x4, chunk[0], chunk[1], chunk[2]))
+				return 0;
+			chunkLength = 0;
+		}
+	}
+	return 1;
+}
+
+void midih_AssignMessageCallback(void (*callback)(uint8_t port, uint8_t status, uint8_t data1, uint8_t data2))
+{
+	messageCallback = callback;
+}
+
+void midih_AssignSysExCallback(void (*callback)(uint8_t port, uint8_t* array, unsigned size))
+{
+	sysExCallback = callback;
+}
+
+
+//---------------------- Private Functions ----------------------//
+uint8_t midih_FindPort(uint8_t idx, uint8_t cable)
+{
+	for(uint8_t port = 0; port < USBH_MIDI_MAX_PORTS; port++)
+	{
+		if(ports[port].used && ports[port].idx == idx && ports[port].cable == cable)
+		{
+			return port;
+		}
+	}
+	return USBH_MIDI_MAX_PORTS;
+}
+
+// Decodes one USB MIDI event packet based on its code index number
+void midih_HandlePacket(uint8_t port, const uint8_t* packet)
+{
+	uint8_t cin = packet[0] & 0x0F;
+
+	switch(cin)
+	{
+		// SysEx start or continue
+		case 0x4:
+			midih_SysExByte(port, packet[1]);
+			midih_SysExByte(port, packet[2]);
+			midih_SysExByte(port, packet[3]);
+			break;
+
+		// Single byte system common, or SysEx ending with 1 byte
+		case 0x5:
+			if(packet[1] == 0xF7)
+				midih_SysExByte(port, packet[1]);
+			else if(messageCallback != nullptr)
+				messageCallback(port, packet[1], 0, 0);
+			break;
+
+		// SysEx ending with 2 or 3 bytes
+		case 0x6:
+		case 0x7:
+			midih_SysExByte(port, packet[1]);
+			midih_SysExByte(port, packet[2]);
+			if(cin == 0x7)
+				midih_SysExByte(port, packet[3]);
+			break;
+
+		// Two and three byte system common, channel messages and single bytes
+		case 0x2:
+		case 0x3:
+		case 0x8:
+		case 0x9:
+		case 0xA:
+		case 0xB:
+		case 0xC:
+		case 0xD:
+		case 0xE:
+		case 0xF:
+			if(messageCallback != nullptr)
+				messageCallback(port, packet[1], packet[2], packet[3]);
+			break;
+
+		// Reserved
+		default:
+			break;
+	}
+}
+
+// Collects SysEx bytes for a port and hands the message on once it ends
+void midih_SysExByte(uint8_t port, uint8_t byte)
+{
+	UsbhMidiPort* midiPort = &ports[port];
+
+	if(midiPort->sysExBuffer == NULL)
+	{
+		return;
+	}
+	if(byte == 0xF0)
+	{
+		midiPort->sysExLength = 0;
+		midiPort->sysExOverflow = 0;
+	}
+	if(midiPort->sysExLength >= USBH_MIDI_SYSEX_MAX_SIZE)
+	{
+		midiPort->sysExOverflow = 1;
+	}
+	else
+	{
+		midiPort->sysExBuffer[midiPort->sysExLength] = byte;
+		midiPort->sysExLength++;
+	}
+
+	if(byte == 0xF7)
+	{
+		if(midiPort->sysExOverflow)
+		{
+			ESP_LOGW(TAG, "SysEx on port %d larger than %d bytes dropped", port, USBH_MIDI_SYSEX_MAX_SIZE);
+		}
+		else if(sysExCallback != nullptr)
+		{
+			sysExCallback(port, midiPort->sysExBuffer, midiPort->sysExLength);
+		}
+		midiPort->sysExLength = 0;
+	}
+}
+
+// Queues one event packet without blocking. If the TX FIFO is full, or older packets are still
+// waiting, the packet joins the interface's backlog, which midih_Process moves on as space frees
+uint8_t midih_WritePacket(uint8_t port, uint8_t cin, uint8_t byte0, uint8_t byte1, uint8_t byte2)
+{
+	if(!midih_PortConnected(port))
+	{
+		return 0;
+	}
+	uint8_t idx = ports[port].idx;
+	uint8_t packet[USBH_MIDI_PACKET_SIZE] = {(uint8_t)((ports[port].cable << 4) | cin), byte0, byte1, byte2};
+
+	if(txBacklogHead[idx] == txBacklogTail[idx])
+	{
+		if(tuh_midi_packet_write_n(idx, packet, 1) == 1)
+		{
+			txPending[idx] = 1;
+			return 1;
+		}
+		// start the transfer so the FIFO empties while the backlog fills
+		tuh_midi_write_flush(idx);
+	}
+	if((uint16_t)(txBacklogHead[idx] - txBacklogTail[idx]) >= USBH_MIDI_TX_BACKLOG)
+	{
+		ESP_LOGW(TAG, "MIDI TX backlog on port %d full, packet dropped", port);
+		return 0;
+	}
+	memcpy(txBacklog[idx][txBacklogHead[idx] & (USBH_MIDI_TX_BACKLOG - 1)], packet, USBH_MIDI_PACKET_SIZE);
+	txBacklogHead[idx]++;
+	return 1;
+}
+
+// Moves backlogged packets into the TX FIFO, in order, until it fills again
+void midih_DrainBacklog(uint8_t idx)
+{
+	while(txBacklogHead[idx] != txBacklogTail[idx])
+	{
+		if(tuh_midi_packet_write_n(idx, txBacklog[idx][txBacklogTail[idx] & (USBH_MIDI_TX_BACKLOG - 1)], 1) != 1)
+		{
+			break;
+		}
+		txBacklogTail[idx]++;
+		txPending[idx] = 1;
+	}
+}
+
+
+//---------------------- Tiny USB Callbacks ----------------------//
+// Invoked when a MIDI interface is mounted. Each of its cables takes a free router port
+extern "C" void tuh_midi_mount_cb(uint8_t idx, const tuh_midi_mount_cb_t* mount_cb_data)
+{
+	uint8_t cables = mount_cb_data->rx_cable_count;
+	uint8_t assigned = 0;
+
+	if(mount_cb_data->tx_cable_count > cables)
+	{
+		cables = mount_cb_data->tx_cable_count;
+	}
+
+	portENTER_CRITICAL(&portsMux);
+	for(uint8_t cable = 0; cable < cables; cable++)
+	{
+		for(uint8_t port = 0; port < USBH_MIDI_MAX_PORTS; port++)
+		{
+			if(!ports[port].used)
+			{
+				ports[port].idx = idx;
+				ports[port].cable = cable;
+				ports[port].sysExLength = 0;
+				ports[port].sysExOverflow = 0;
+				ports[port].used = 1;
+				assigned++;
+				break;
+			}
+		}
+	}
+	rxPending[idx] = 1;
+	portEXIT_CRITICAL(&portsMux);
+
+	ESP_LOGI(TAG, "MIDI device %d mounted, %d of %d cables assigned to ports", mount_cb_data->daddr, assigned, cables);
+}
+
+// Invoked when a MIDI interface is unmounted
+extern "C" void tuh_midi_umount_cb(uint8_t idx)
+{
+	portENTER_CRITICAL(&portsMux);
+	for(uint8_t port = 0; port < USBH_MIDI_MAX_PORTS; port++)
+	{
+		if(ports[port].used && ports[port].idx == idx)
+		{
+			ports[port].used = 0;
+		}
+	}
+	rxPending[idx] = 0;
+	txPending[idx] = 0;
+	txBacklogTail[idx] = txBacklogHead[idx];
+	portEXIT_CRITICAL(&portsMux);
+	ESP_LOGI(TAG, "MIDI interface %d unmounted", idx);
+}
+
+// Invoked when a bulk IN transfer has completed. The data is read by the MIDI task
+extern "C" void tuh_midi_rx_cb(uint8_t idx, uint32_t xferred_bytes)
+{
+	if(xferred_bytes > 0)
+	{
+		rxPending[idx] = 1;
+	}
+}
+
+#endif
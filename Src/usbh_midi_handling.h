@@ -0,0 +1,24 @@
+#ifndef USBH_MIDI_HANDLING_H_
+#define USBH_MIDI_HANDLING_H_
+#ifdef USE_USBH_MIDI
+#include "stdint.h"
+
+// Each cable of each connected USB MIDI device is given its own router port
+#ifndef USBH_MIDI_MAX_PORTS
+#define USBH_MIDI_MAX_PORTS				4
+#endif
+#define USBH_MIDI_SYSEX_MAX_SIZE		1024
+
+void midih_Init();
+void midih_Process();
+uint8_t midih_PortConnected(uint8_t port);
+
+uint8_t midih_SendMessage(uint8_t port, uint8_t status, uint8_t data1, uint8_t data2);
+uint8_t midih_SendPacket(uint8_t port, const uint8_t* packet);
+uint8_t midih_SendSysEx(uint8_t port, const uint8_t* array, unsigned size, uint8_t containsFraming);
+
+void midih_AssignMessageCallback(void (*callback)(uint8_t port, uint8_t status, uint8_t data1, uint8_t data2));
+void midih_AssignSysExCallback(void (*callback)(uint8_t port, uint8_t* array, unsigned size));
+
+#endif
+#endif // USBH_MIDI_HANDLING_H_
@@ -19,14 +19,29 @@ const char* wifiApPassword = NULL;
 uint8_t newWifiEvent = 0;
 
 void wifi_UpdateInfoTask();
+void wifi_ApplyConfig(const Esp32ManagerConfig* previous, const Esp32ManagerConfig* config);
 
 // RTOS Tasks
 void wifi_ProcessTask(void* parameter)
 {
 	static uint16_t wifiProcessCount = 0;
+	Esp32ManagerConfig appliedConfig = *esp32ConfigPtr;
+#ifdef USE_LAZY_INIT
+	esp32Manager_InitWiFi();
+#endif
 	//UBaseType_t uxHighWaterMark;
 	while(1)
 	{
+		// WiFi is not restarted while an update is downloading
+		if(!ota_InProgress())
+		{
+			const Esp32ManagerSnapshot* snapshot = esp32Manager_ConfigSafePoint(Esp32ReaderWiFi);
+			if(snapshot != NULL)
+			{
+				wifi_ApplyConfig(&appliedConfig, &snapshot->config);
+				appliedConfig = snapshot->config;
+			}
+		}
 		if(esp32ConfigPtr->wirelessType != Esp32WiFi)
 		{
 			vTaskDelay(1000 / portTICK_PERIOD_MS);
@@ -49,6 +64,30 @@ void wifi_ProcessTask(void* parameter)
 	}
 }
 
+// Reconnects WiFi only if the change affects it
+void wifi_ApplyConfig(const Esp32ManagerConfig* previous, const Esp32ManagerConfig* config)
+{
+	uint8_t wasOn = previous->wirelessType == Esp32WiFi;
+	uint8_t on = config->wirelessType == Esp32WiFi;
+	uint8_t changed = previous->wifiMode != config->wifiMode
+		|| previous->useStaticIp != config->useStaticIp
+		|| memcmp(previous->staticIp, config->staticIp, sizeof(config->staticIp)) != 0
+		|| memcmp(previous->staticGatewayIp, config->staticGatewayIp, sizeof(config->staticGatewayIp)) != 0;
+
+	if(wasOn && (!on || changed))
+	{
+#ifdef USE_WIFI_RTP_MIDI
+		midi_StopWiFiRTP();
+#endif
+		wifi_Disconnect();
+		ESP_LOGI(WIFI_TAG, "WiFi stopped for config change");
+	}
+	if(on && (!wasOn || changed))
+	{
+		esp32Manager_InitWiFi();
+	}
+}
+
 void wifi_UpdateInfoTask()
 {
 	// Check the WiFi connection status
@@ -0,0 +1,95 @@
+// Host benchmark of the table driven CRC-16 in Src/crc16.cpp against the bit-serial loop it
+// replaced in tonexOne.cpp. Frame sized buffers are checksummed repeatedly and the throughput of
+// each variant printed in bytes/s, after checking both give the same CRC.
+//
+//     g++ -O2 -DDRAM_ATTR= -ISrc tools/crc16_bench.cpp Src/crc16.cpp -o crc16_bench
+//     ./crc16_bench [bytes] [iterations]
+//
+// The default 30 KB buffer is the size of a full preset details response.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "crc16.h"
+
+#define BENCH_DEFAULT_BYTES			30720
+#define BENCH_DEFAULT_ITERATIONS		2000
+
+// Bit-serial CRC-16/X.25, as tonexOne_CalculateCRC computed it
+uint16_t bench_BitSerialCrc(const uint8_t* data, size_t length)
+{
+	uint16_t crc = 0xFFFF;
+
+	for (size_t loop = 0; loop < length; loop++)
+	{
+		crc ^= data[loop];
+		for (uint8_t i = 0; i < 8; ++i)
+		{
+			if (crc & 1)
+			{
+				crc = (crc >> 1) ^ 0x8408;
+			}
+			else
+			{
+				crc = crc >> 1;
+			}
+		}
+	}
+	return ~crc;
+}
+
+// Streaming path used by the RX de-framer, one byte at a time
+uint16_t bench_PerByteCrc(const uint8_t* data, size_t length)
+{
+	uint16_t crc = CRC16_INIT;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		crc = crc16_Update(crc, data[i]);
+	}
+	return ~crc;
+}
+
+double bench_Run(const char* name, uint16_t (*crc)(const uint8_t*, size_t), const std::vector<uint8_t>& data, unsigned iterations)
+{
+	volatile uint16_t sink = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	for (unsigned i = 0; i < iterations; i++)
+	{
+		sink = sink ^ crc(data.data(), data.size());
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double rate = (double)data.size() * iterations / seconds;
+
+	printf("%-12s %12.0f bytes/s  (%.1f MB/s)\n", name, rate, rate / 1e6);
+	return rate;
+}
+
+int main(int argc, char** argv)
+{
+	size_t bytes = argc > 1 ? strtoul(argv[1], NULL, 0) : BENCH_DEFAULT_BYTES;
+	unsigned iterations = argc > 2 ? strtoul(argv[2], NULL, 0) : BENCH_DEFAULT_ITERATIONS;
+	std::vector<uint8_t> data(bytes);
+
+	srand(1);
+	for (size_t i = 0; i < bytes; i++)
+	{
+		data[i] = rand() & 0xFF;
+	}
+
+	uint16_t expected = bench_BitSerialCrc(data.data(), bytes);
+	if (crc16_Calculate(data.data(), bytes) != expected || bench_PerByteCrc(data.data(), bytes) != expected)
+	{
+		printf("CRC mismatch against the bit-serial reference\n");
+		return 1;
+	}
+
+	printf("%zu byte buffer, %u iterations, CRC 0x%04X\n", bytes, iterations, expected);
+	double serial = bench_Run("bit-serial", bench_BitSerialCrc, data, iterations);
+	double block = bench_Run("table block", crc16_Calculate, data, iterations);
+	double perByte = bench_Run("table byte", bench_PerByteCrc, data, iterations);
+	printf("table block is %.1fx, table byte is %.1fx the bit-serial rate\n", block / serial, perByte / serial);
+	return 0;
+}
@@ -0,0 +1,282 @@
+#!/usr/bin/env python3
+"""Delta OTA images for esp32-manager.
+
+Makes and applies the patches read by OTADeltaPatcher (Src/ota_delta.h). A patch rebuilds the new
+firmware image from the one running on the device, so a point release only ships the bytes that
+actually changed.
+
+    ota_delta.py diff old.bin new.bin patch.bin     make a patch
+    ota_delta.py apply old.bin patch.bin out.bin    apply a patch the way the device does
+    ota_delta.py check old.bin new.bin              make a patch in memory and round trip it
+    ota_delta.py selftest                           round trip generated images
+
+The manifest entry for a delta adds "DeltaURL" (the patch) and "DeltaFrom" (the version it was
+made from) next to the full image "URL". "SHA256" is the digest of the new image.
+"""
+
+import argparse
+import hashlib
+import random
+import struct
+import sys
+
+MAGIC = b"EDP1"
+HEADER = struct.Struct("<4sII32s32s")
+
+OP_END = 0
+OP_COPY = 1
+OP_ADD = 2
+OP_INSERT = 3
+OP_SEEK = 4
+
+ANCHOR = 16         # bytes that must match exactly to start following a new alignment
+STRIDE = 4          # old image positions indexed for anchors
+WINDOW = 32         # an aligned region ends when this many trailing bytes are mostly different
+MIN_COPY = 4        # shorter runs of unchanged bytes stay inside an add
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def zigzag(value):
+    return (value << 1) if value >= 0 else ((-value << 1) - 1)
+
+
+class PatchWriter:
+    def __init__(self, old, new):
+        self.out = bytearray(HEADER.pack(MAGIC, len(old), len(new),
+                                         hashlib.sha256(old).digest(), hashlib.sha256(new).digest()))
+        self.old_pos = 0
+
+    def op(self, code, argument, data=b""):
+        self.out.append(code)
+        self.out += varint(argument)
+        self.out += data
+
+    def seek(self, position):
+        if position != self.old_pos:
+            self.op(OP_SEEK, zigzag(position - self.old_pos))
+            self.old_pos = position
+
+    def insert(self, data):
+        if data:
+            self.op(OP_INSERT, len(data), bytes(data))
+
+    def aligned(self, old, new, start, end, offset):
+        """Emits new[start:end] as copies and adds against old[start + offset:]."""
+        self.seek(start + offset)
+        diff = bytes((new[i] - old[i + offset]) & 0xFF for i in range(start, end))
+        i = 0
+        while i < len(diff):
+            run = i
+            while run < len(diff) and diff[run] == 0:
+                run += 1
+            if run - i >= MIN_COPY or run == len(diff):
+                if run > i:
+                    self.op(OP_COPY, run - i)
+                i = run
+                continue
+            # add until the next long unchanged run
+            j = i
+            while j < len(diff):
+                zeros = j
+                while zeros < len(diff) and diff[zeros] == 0:
+                    zeros += 1
+                if zeros - j >= MIN_COPY:
+                    break
+                j = zeros if zeros > j else j + 1
+            self.op(OP_ADD, j - i, diff[i:j])
+            i = j
+        self.old_pos = end + offset
+
+    def finish(self):
+        self.out.append(OP_END)
+        return bytes(self.out)
+
+
+def diff(old, new):
+    index = {}
+    for position in range(0, len(old) - ANCHOR + 1, STRIDE):
+        index.setdefault(old[position:position + ANCHOR], position)
+
+    patch = PatchWriter(old, new)
+    literal = bytearray()
+    offset = 0
+    i = 0
+    while i < len(new):
+        # keep following the current alignment while it still matches
+        if 0 <= i + offset and i + offset + ANCHOR <= len(old) and \
+                sum(new[i + k] == old[i + offset + k] for k in range(min(ANCHOR, len(new) - i))) >= ANCHOR * 3 // 4:
+            end = extend(old, new, i, offset)
+            patch.insert(literal)
+            literal.clear()
+            patch.aligned(old, new, i, end, offset)
+            i = end
+            continue
+
+        found = index.get(new[i:i + ANCHOR])
+        if found is not None:
+            offset = found - i
+            continue
+        literal.append(new[i])
+        i += 1
+
+    patch.insert(literal)
+    return patch.finish()
+
+
+def extend(old, new, start, offset):
+    """Returns where an aligned region starting at start stops being worth following."""
+    end = start
+    last_match = start
+    misses = []
+    while end < len(new) and end + offset < len(old):
+        miss = new[end] != old[end + offset]
+        misses.append(miss)
+        if not miss:
+            last_match = end
+        if len(misses) > WINDOW:
+            misses.pop(0)
+        if len(misses) == WINDOW and sum(misses) > WINDOW // 2:
+            break
+        end += 1
+    return max(last_match + 1, start + 1) if end < len(new) and end + offset < len(old) else end
+
+
+def read_varint(patch, position):
+    value = 0
+    shift = 0
+    while True:
+        byte = patch[position]
+        position += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, position
+
+
+def apply(old, patch):
+    magic, old_size, new_size, old_digest, new_digest = HEADER.unpack_from(patch)
+    if magic != MAGIC:
+        raise ValueError("not a delta patch")
+    if old_size > len(old) or hashlib.sha256(old[:old_size]).digest() != old_digest:
+        raise ValueError("patch is not for this image")
+    old = old[:old_size]
+
+    out = bytearray()
+    old_pos = 0
+    position = HEADER.size
+    while True:
+        code = patch[position]
+        position += 1
+        if code == OP_END:
+            break
+        argument, position = read_varint(patch, position)
+        if code == OP_COPY:
+            out += old[old_pos:old_pos + argument]
+            old_pos += argument
+        elif code == OP_ADD:
+            out += bytes((patch[position + k] + old[old_pos + k]) & 0xFF for k in range(argument))
+            old_pos += argument
+            position += argument
+        elif code == OP_INSERT:
+            out += patch[position:position + argument]
+            position += argument
+        elif code == OP_SEEK:
+            old_pos += (argument >> 1) ^ -(argument & 1)
+        else:
+            raise ValueError("unknown operation %d" % code)
+        if old_pos < 0 or old_pos > old_size:
+            raise ValueError("patch reads outside the old image")
+
+    if len(out) != new_size or hashlib.sha256(out).digest() != new_digest:
+        raise ValueError("patched image does not match")
+    return bytes(out)
+
+
+def round_trip(old, new):
+    patch = diff(old, new)
+    if apply(old, patch) != new:
+        raise ValueError("round trip mismatch")
+    return patch
+
+
+def mutate(rng, data):
+    data = bytearray(data)
+    for _ in range(rng.randint(1, 20)):
+        position = rng.randrange(len(data))
+        kind = rng.randrange(4)
+        if kind == 0:
+            data[position:position] = bytes(rng.randrange(256) for _ in range(rng.randint(1, 200)))
+        elif kind == 1:
+            del data[position:position + rng.randint(1, 200)]
+        elif kind == 2:
+            # shifted pointers, the case adds are for
+            for k in range(position, min(len(data), position + 2000), 16):
+                data[k] = (data[k] + 4) & 0xFF
+        else:
+            data[position] = rng.randrange(256)
+    return bytes(data)
+
+
+def selftest():
+    rng = random.Random(1)
+    for size in (0, 1, 100, 5000, 200000):
+        old = bytes(rng.randrange(256) for _ in range(size))
+        for new in (old, b"", mutate(rng, old) if old else b"new", bytes(rng.randrange(256) for _ in range(size // 2))):
+            patch = round_trip(old, new)
+            print("old %7d new %7d patch %7d" % (len(old), len(new), len(patch)))
+    print("ok")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Make and apply esp32-manager delta OTA images")
+    commands = parser.add_subparsers(dest="command", required=True)
+    command = commands.add_parser("diff")
+    command.add_argument("old")
+    command.add_argument("new")
+    command.add_argument("patch")
+    command = commands.add_parser("apply")
+    command.add_argument("old")
+    command.add_argument("patch")
+    command.add_argument("out")
+    command = commands.add_parser("check")
+    command.add_argument("old")
+    command.add_argument("new")
+    commands.add_parser("selftest")
+    args = parser.parse_args()
+
+    if args.command == "selftest":
+        selftest()
+        return 0
+
+    with open(args.old, "rb") as f:
+        old = f.read()
+    if args.command == "apply":
+        with open(args.patch, "rb") as f:
+            patch = f.read()
+        with open(args.out, "wb") as f:
+            f.write(apply(old, patch))
+        return 0
+
+    with open(args.new, "rb") as f:
+        new = f.read()
+    patch = round_trip(old, new)
+    print("%s: %d bytes, patch %d bytes, SHA256 %s" % (args.new, len(new), len(patch), hashlib.sha256(new).hexdigest()))
+    if args.command == "diff":
+        with open(args.patch, "wb") as f:
+            f.write(patch)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())